@@ -0,0 +1,364 @@
+/*
+ * bench.c - Repeated timing runs and their statistics
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define MAXLINE 1024
+#define GOVLEN  64      /* longest governor name, with its NUL */
+
+/* Header line of the CSV format */
+#define CSV_HEADER "trace,ops,reps,median_secs,mad_secs,ci_lo_secs,ci_hi_secs"
+
+/* What starts each result line of the JSON format */
+#define JSON_TRACE "{\"trace\": "
+
+/*
+ * cmp_double - qsort comparison of doubles
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * median_of - Median of n sorted values
+ */
+static double median_of(double *v, int n)
+{
+    return (n % 2) ? v[n/2] : (v[n/2 - 1] + v[n/2]) / 2;
+}
+
+/*
+ * bench_summarize - Summarize n timing samples. The confidence
+ *     interval of the median is given by the order statistics whose
+ *     ranks are n/2 -+ 1.96 sqrt(n)/2, which holds whatever the
+ *     distribution of the samples (runs hit by interrupts are common,
+ *     so it is anything but normal).
+ */
+void bench_summarize(double *samples, int n, bench_t *b)
+{
+    double *dev;
+    int i, lo, hi;
+
+    b->reps = n;
+    if (n == 0) {
+	b->median = b->mad = b->ci_lo = b->ci_hi = 0;
+	return;
+    }
+    qsort(samples, n, sizeof(double), cmp_double);
+    b->median = median_of(samples, n);
+
+    if ((dev = (double *)malloc(n * sizeof(double))) == NULL) {
+	b->mad = 0;
+    }
+    else {
+	for (i = 0; i < n; i++)
+	    dev[i] = fabs(samples[i] - b->median);
+	qsort(dev, n, sizeof(double), cmp_double);
+	b->mad = median_of(dev, n);
+	free(dev);
+    }
+
+    lo = (int)floor((n - 1.96 * sqrt(n)) / 2);      /* 0-based ranks */
+    hi = (int)ceil((n + 1.96 * sqrt(n)) / 2);
+    b->ci_lo = samples[(lo < 0) ? 0 : lo];
+    b->ci_hi = samples[(hi > n - 1) ? n - 1 : hi];
+}
+
+/*
+ * bench_pin - Pin the calling thread to one cpu
+ */
+int bench_pin(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* The governor bench_governor replaced, as the line to write back at
+   exit (or on a fatal signal) */
+static char saved_path[MAXLINE];
+static char saved_gov[GOVLEN + 1];
+static size_t saved_len = 0;
+
+/* Signals that would otherwise leave the cpu in "performance" */
+static int fatal_signals[] = {SIGINT, SIGTERM, SIGHUP};
+
+/*
+ * read_governor - Read the governor at path into gov; NULL on error
+ */
+static char *read_governor(char *path, char *gov, int size)
+{
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return NULL;
+    if (fgets(gov, size, fp) == NULL) {
+	fclose(fp);
+	return NULL;
+    }
+    fclose(fp);
+    gov[strcspn(gov, "\n")] = '\0';
+    return gov;
+}
+
+/*
+ * restore_governor - atexit handler that undoes bench_governor. Uses
+ *     only async-signal-safe calls, so restore_on_signal can call it.
+ */
+static void restore_governor(void)
+{
+    int fd;
+
+    if (saved_len > 0 && (fd = open(saved_path, O_WRONLY | O_TRUNC)) >= 0) {
+	if (write(fd, saved_gov, saved_len) < 0)
+	    ;   /* nothing left to do about it */
+	close(fd);
+    }
+}
+
+/*
+ * restore_on_signal - Handler for fatal_signals: restore the governor,
+ *     then die of the signal (SA_RESETHAND put the default action back)
+ */
+static void restore_on_signal(int sig)
+{
+    restore_governor();
+    raise(sig);
+}
+
+/*
+ * catch_fatal_signals - Restore the governor on fatal_signals too,
+ *     except where the program set its own handler
+ */
+static void catch_fatal_signals(void)
+{
+    struct sigaction sa, old;
+    int i;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = restore_on_signal;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0; i < (int)(sizeof(fatal_signals) / sizeof(int)); i++)
+	if (sigaction(fatal_signals[i], NULL, &old) == 0 &&
+	    old.sa_handler == SIG_DFL)
+	    sigaction(fatal_signals[i], &sa, NULL);
+}
+
+/*
+ * bench_governor - Read (and, if set, first try to change) the cpufreq
+ *     governor of a cpu. Changing it needs root, and virtual machines
+ *     usually have no cpufreq at all, so failure is quietly accepted.
+ *     A governor that was changed is restored when the program exits,
+ *     or is killed by SIGINT, SIGTERM or SIGHUP.
+ */
+char *bench_governor(int cpu, int set)
+{
+    static char gov[GOVLEN];
+    char path[MAXLINE];
+    FILE *fp;
+
+    sprintf(path, "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+	    cpu);
+    if (read_governor(path, gov, sizeof(gov)) == NULL)
+	return NULL;
+    if (set && saved_len == 0 && strcmp(gov, "performance") != 0 &&
+	(fp = fopen(path, "w")) != NULL) {
+	fprintf(fp, "performance\n");
+	if (fclose(fp) == 0) {
+	    strcpy(saved_path, path);
+	    saved_len = sprintf(saved_gov, "%s\n", gov);
+	    atexit(restore_governor);
+	    catch_fatal_signals();
+	}
+    }
+    return read_governor(path, gov, sizeof(gov));
+}
+
+/*
+ * is_json - Does path end in .json?
+ */
+static int is_json(char *path)
+{
+    size_t len = strlen(path);
+
+    return len >= 5 && strcmp(path + len - 5, ".json") == 0;
+}
+
+/*
+ * write_name - Write a trace name as a CSV field (quoted, with quotes
+ *     doubled, if it holds a comma, a quote or a line break, as in
+ *     RFC 4180) or as a JSON string
+ */
+static void write_name(FILE *fp, char *name, int json)
+{
+    char *p;
+
+    if (!json && strpbrk(name, ",\"\r\n") == NULL) {
+	fputs(name, fp);
+	return;
+    }
+    fputc('"', fp);
+    for (p = name; *p != '\0'; p++) {
+	if (*p == '"')
+	    fputs(json ? "\\\"" : "\"\"", fp);
+	else if (json && *p == '\\')
+	    fputs("\\\\", fp);
+	else if (json && (unsigned char)*p < 0x20)
+	    fprintf(fp, "\\u%04x", (unsigned char)*p);
+	else
+	    fputc(*p, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * read_name - Parse a trace name written by write_name at line into
+ *     name (truncated to BENCH_NAMELEN); returns what follows it, or
+ *     NULL if line does not start with one
+ */
+static char *read_name(char *line, char *name, int json)
+{
+    char *p = line;
+    unsigned int c;
+    int len = 0, quoted = json || *p == '"';
+
+    if (json && *p != '"')
+	return NULL;
+    if (quoted)
+	p++;
+    while (*p != '\0' && *p != '\n') {
+	if (quoted && *p == '"') {
+	    if (json || p[1] != '"')
+		break;          /* closing quote */
+	    c = '"';            /* "" in CSV */
+	    p += 2;
+	}
+	else if (!quoted && *p == ',') {
+	    break;
+	}
+	else if (json && *p == '\\') {
+	    if (p[1] == 'u' && sscanf(p + 2, "%4x", &c) == 1)
+		p += 6;
+	    else if (p[1] != '\0') {
+		c = (unsigned char)p[1];
+		p += 2;
+	    }
+	    else {
+		return NULL;
+	    }
+	}
+	else {
+	    c = (unsigned char)*p++;
+	}
+	if (len < BENCH_NAMELEN - 1)
+	    name[len++] = (char)c;
+    }
+    name[len] = '\0';
+    if (quoted) {
+	if (*p != '"')
+	    return NULL;
+	p++;
+    }
+    return p;
+}
+
+/*
+ * bench_write - Save results. The JSON form has one trace per line so
+ *     that bench_read can parse it without a JSON library.
+ */
+int bench_write(char *path, bench_t *b, int n)
+{
+    FILE *fp;
+    int i, json = is_json(path);
+
+    if ((fp = fopen(path, "w")) == NULL)
+	return -1;
+    if (json) {
+	fprintf(fp, "{\"results\": [\n");
+	for (i = 0; i < n; i++) {
+	    fprintf(fp, "  %s", JSON_TRACE);
+	    write_name(fp, b[i].trace, 1);
+	    fprintf(fp, ", \"ops\": %.0f, \"reps\": %d, "
+		    "\"median_secs\": %.9f, \"mad_secs\": %.9f, "
+		    "\"ci_lo_secs\": %.9f, \"ci_hi_secs\": %.9f}%s\n",
+		    b[i].ops, b[i].reps, b[i].median, b[i].mad,
+		    b[i].ci_lo, b[i].ci_hi, (i < n - 1) ? "," : "");
+	}
+	fprintf(fp, "]}\n");
+    }
+    else {
+	fprintf(fp, "%s\n", CSV_HEADER);
+	for (i = 0; i < n; i++) {
+	    write_name(fp, b[i].trace, 0);
+	    fprintf(fp, ",%.0f,%d,%.9f,%.9f,%.9f,%.9f\n",
+		    b[i].ops, b[i].reps, b[i].median, b[i].mad,
+		    b[i].ci_lo, b[i].ci_hi);
+	}
+    }
+    return fclose(fp);
+}
+
+/*
+ * bench_read - Load results saved by bench_write
+ */
+int bench_read(char *path, bench_t **b)
+{
+    FILE *fp;
+    char line[MAXLINE], *rest;
+    int n = 0, cap = 16, json = is_json(path), ok;
+    bench_t *r;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return -1;
+    if ((*b = (bench_t *)malloc(cap * sizeof(bench_t))) == NULL) {
+	fclose(fp);
+	return -1;
+    }
+
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	if (n == cap) {
+	    cap *= 2;
+	    if ((*b = (bench_t *)realloc(*b, cap * sizeof(bench_t))) == NULL) {
+		fclose(fp);
+		return -1;
+	    }
+	}
+	r = &(*b)[n];
+	ok = 0;
+	if (json) {
+	    rest = line + strspn(line, " ");
+	    if (strncmp(rest, JSON_TRACE, strlen(JSON_TRACE)) == 0 &&
+		(rest = read_name(rest + strlen(JSON_TRACE), r->trace, 1)) != NULL)
+		ok = sscanf(rest, ", \"ops\": %lf, \"reps\": %d, "
+			    "\"median_secs\": %lf, \"mad_secs\": %lf, "
+			    "\"ci_lo_secs\": %lf, \"ci_hi_secs\": %lf",
+			    &r->ops, &r->reps, &r->median, &r->mad,
+			    &r->ci_lo, &r->ci_hi);
+	}
+	else if ((rest = read_name(line, r->trace, 0)) != NULL) {
+	    ok = sscanf(rest, ",%lf,%d,%lf,%lf,%lf,%lf",
+			&r->ops, &r->reps, &r->median, &r->mad,
+			&r->ci_lo, &r->ci_hi);
+	}
+	if (ok == 6)
+	    n++;    /* anything else is a header or bracket line */
+    }
+    fclose(fp);
+    return n;
+}
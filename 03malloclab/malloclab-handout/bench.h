@@ -0,0 +1,46 @@
+#ifndef __BENCH_H_
+#define __BENCH_H_
+
+/*
+ * bench.h - Repeated timing runs and their statistics
+ *
+ * A trace is timed several times after some warmup runs, and the
+ * samples are summarized by their median, their median absolute
+ * deviation (MAD) and a distribution-free 95% confidence interval for
+ * the median. Results can be saved as CSV or JSON (chosen by the file
+ * suffix) and two result files compared with mmcompare.
+ */
+
+#define BENCH_NAMELEN 128
+
+/* Timing summary of one trace */
+typedef struct {
+    char trace[BENCH_NAMELEN]; /* trace file name */
+    double ops;                /* requests in the trace */
+    int reps;                  /* number of timed runs */
+    double median;             /* median running time (secs) */
+    double mad;                /* median absolute deviation (secs) */
+    double ci_lo, ci_hi;       /* 95% confidence interval of the median */
+} bench_t;
+
+/* Summarize n samples (sorted in place) into b */
+void bench_summarize(double *samples, int n, bench_t *b);
+
+/* Pin the calling thread to cpu; returns 0 on success, -1 on error */
+int bench_pin(int cpu);
+
+/*
+ * Frequency governor of cpu, after trying to switch it to
+ * "performance" if set is nonzero (the old one is restored at exit or
+ * on SIGINT, SIGTERM and SIGHUP);
+ * NULL if it cannot be read
+ */
+char *bench_governor(int cpu, int set);
+
+/* Write n results to path as CSV, or as JSON if path ends in .json */
+int bench_write(char *path, bench_t *b, int n);
+
+/* Read results written by bench_write; returns their number or -1 */
+int bench_read(char *path, bench_t **b);
+
+#endif /* __BENCH_H_ */
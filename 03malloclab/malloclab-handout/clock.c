@@ -1,6 +1,6 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the time stamp counter on x86 and
+ *           x86-64 boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -9,138 +9,139 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
 #include "clock.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+/* How long mhz() measures the TSC when its rate is not reported */
+#define CALIBRATE_MS 50
+
 
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
- * are set by GCC when it calls the C preprocessor
- * You can verify this for yourself using gcc -v.
+ * Note: the constants __x86_64__ and __i386__ are set by GCC
+ * when it calls the C preprocessor. You can verify this for
+ * yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__x86_64__) || defined(__i386__)
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * x86 versions of start_counter() and get_counter()
+ *
+ * Both read the time stamp counter, which on any cpu with an
+ * invariant TSC ticks at a constant rate regardless of frequency
+ * scaling and sleep states. The reads are fenced so that the timed
+ * code can neither start before start_counter's read nor still be
+ * running when get_counter's read happens:
+ *
+ *   start:  lfence; rdtsc; lfence   (earlier work done, later waits)
+ *   stop:   rdtscp; lfence          (earlier work done, later waits)
  *******************************************************/
 
-
-/* $begin x86cyclecounter */
 /* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+static unsigned long long cyc_start = 0;
 
+/* Read the TSC after all earlier instructions have completed */
+static unsigned long long read_tsc_start(void)
+{
+    unsigned hi, lo;
+
+    asm volatile("lfence; rdtsc; lfence"
+		 : "=d" (hi), "=a" (lo) : : "memory");
+    return ((unsigned long long)hi << 32) | lo;
+}
 
-/* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
-void access_counter(unsigned *hi, unsigned *lo)
+/* Read the TSC once all earlier instructions (the timed code) are done */
+static unsigned long long read_tsc_stop(void)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-	: "=r" (*hi), "=r" (*lo)                /* and move results to */
-	: /* No input */                        /* the two outputs */
-	: "%edx", "%eax");
+    unsigned hi, lo, aux;
+
+    asm volatile("rdtscp; lfence"
+		 : "=d" (hi), "=a" (lo), "=c" (aux) : : "memory");
+    return ((unsigned long long)hi << 32) | lo;
 }
 
 /* Record the current value of the cycle counter. */
 void start_counter()
 {
-    access_counter(&cyc_hi, &cyc_lo);
+    cyc_start = read_tsc_start();
 }
 
 /* Return the number of cycles since the last call to start_counter. */
 double get_counter()
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
-
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
+    unsigned long long now = read_tsc_stop();
 
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-	fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
+    if (now < cyc_start) {
+	fprintf(stderr, "Error: counter went backwards by %llu cycles\n",
+		cyc_start - now);
+	return 0;
     }
-    return result;
+    return (double)(now - cyc_start);
 }
-/* $end x86cyclecounter */
-
-#elif defined(__alpha)
-
-/****************************************************
- * Alpha versions of start_counter() and get_counter()
- ***************************************************/
-
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
-
-
-/* Use Alpha cycle timer to compute cycles.  Then use
-   measured clock speed to compute seconds 
-*/
 
 /*
- * counterRoutine is an array of Alpha instructions to access 
- * the Alpha's processor cycle counter. It uses the rpcc 
- * instruction to access the counter. This 64 bit register is 
- * divided into two parts. The lower 32 bits are the cycles 
- * used by the current process. The upper 32 bits are wall 
- * clock cycles. These instructions read the counter, and 
- * convert the lower 32 bits into an unsigned int - this is the 
- * user space counter value.
- * NOTE: The counter has a very limited time span. With a 
- * 450MhZ clock the counter can time things for about 9 
- * seconds. */
-static unsigned int counterRoutine[] =
+ * tsc_invariant - Does the TSC tick at a constant rate in all P-, C-
+ *     and T-states? (CPUID.80000007H:EDX[8])
+ */
+int tsc_invariant()
 {
-    0x601fc000u,
-    0x401f0000u,
-    0x6bfa8001u
-};
-
-/* Cast the above instructions into a function. */
-static unsigned int (*counter)(void)= (void *)counterRoutine;
+    unsigned a, b, c, d;
 
-
-void start_counter()
-{
-    /* Get cycle counter */
-    cyc_hi = 0;
-    cyc_lo = counter();
+    if (!__get_cpuid(0x80000007, &a, &b, &c, &d))
+	return 0;
+    return (d >> 8) & 1;
 }
 
-double get_counter()
+/*
+ * tsc_mhz - TSC frequency as reported by the hardware or kernel, or 0
+ *     if neither knows it, in which case mhz() calibrates against the
+ *     monotonic clock. CPUID leaf 0x15 gives the exact ratio of the TSC
+ *     to the core crystal clock on recent Intel parts; when it leaves
+ *     the crystal frequency out, leaf 0x16 still gives the nominal base
+ *     frequency, which the invariant TSC runs at. Mainline kernels do
+ *     not export their own calibration, but some patched ones do as
+ *     cpu0/tsc_freq_khz, so that file is tried last.
+ */
+static double tsc_mhz()
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
-    ncyc_lo = counter();
-    ncyc_hi = 0;
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-	fprintf(stderr, "Error: Cycle counter returning negative value: %.0f\n", result);
+    unsigned a, b, c, d, max;
+    FILE *fp;
+    double khz;
+
+    if (__get_cpuid(0, &max, &b, &c, &d)) {
+	if (max >= 0x15) {
+	    __get_cpuid_count(0x15, 0, &a, &b, &c, &d);
+	    if (a != 0 && b != 0 && c != 0)
+		return (double)c * b / a / 1e6;
+	}
+	if (max >= 0x16) {
+	    __get_cpuid_count(0x16, 0, &a, &b, &c, &d);
+	    if ((a & 0xffff) != 0)
+		return a & 0xffff;
+	}
     }
-    return result;
+
+    if ((fp = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r"))) {
+	if (fscanf(fp, "%lf", &khz) != 1)
+	    khz = 0;
+	fclose(fp);
+	return khz / 1e3;
+    }
+    return 0;
 }
 
 #else
 
 /****************************************************************
  * All the other platforms for which we haven't implemented cycle
- * counter routines. Newer models of sparcs (v8plus) have cycle
- * counters that can be accessed from user programs, but since there
- * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
+ * counter routines. config.h selects another timing package on
+ * these, so the routines below only report the mistake.
  ***************************************************************/
 
 void start_counter()
@@ -158,6 +159,16 @@ double get_counter()
     printf("Please choose another timing package in config.h.\n");
     exit(1);
 }
+
+int tsc_invariant()
+{
+    return 0;
+}
+
+static double tsc_mhz()
+{
+    return 0;
+}
 #endif
 
 
@@ -181,24 +192,41 @@ double ovhd()
 
 /* $begin mhz */
 /* Estimate the clock rate by measuring the cycles that elapse */ 
-/* while sleeping for sleeptime seconds */
-double mhz_full(int verbose, int sleeptime)
+/* during msecs milliseconds of the monotonic clock */
+double mhz_full(int verbose, int msecs)
 {
-    double rate;
+    struct timespec t0, t1;
+    double rate, secs;
 
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
     start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
+    do {
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    } while (secs < msecs * 1e-3);
+    rate = get_counter() / (1e6*secs);
     if (verbose) 
 	printf("Processor clock rate ~= %.1f MHz\n", rate);
     return rate;
 }
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/* 
+ * mhz - Use the TSC frequency reported by the cpu or the kernel, and
+ *     only fall back to measuring it when neither knows
+ */
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    double rate;
+
+    if (verbose && !tsc_invariant())
+	printf("Warning: TSC is not invariant; cycle counts may drift\n");
+    if ((rate = tsc_mhz()) > 0) {
+	if (verbose)
+	    printf("TSC rate = %.1f MHz\n", rate);
+	return rate;
+    }
+    return mhz_full(verbose, CALIBRATE_MS);
 }
 
 /** Special counters that compensate for timer interrupt overhead */
@@ -9,11 +9,14 @@ double get_counter();
 /* Measure overhead for counter */
 double ovhd();
 
-/* Determine clock rate of processor (using a default sleeptime) */
+/* Does the cycle counter tick at a constant rate? */
+int tsc_invariant();
+
+/* Determine the cycle counter rate (reported, or measured briefly) */
 double mhz(int verbose);
 
-/* Determine clock rate of processor, having more control over accuracy */
-double mhz_full(int verbose, int sleeptime);
+/* Measure the cycle counter rate over msecs milliseconds */
+double mhz_full(int verbose, int msecs);
 
 /** Special counters that compensate for timer interrupt overhead */
 
@@ -65,8 +65,29 @@
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#if defined(__x86_64__) || defined(__i386__)
+#define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#else
+#define USE_FCYC   0
+#define USE_ITIMER 0
+#define USE_GETTOD 1
+#endif
+
+/*
+ * Parameters of the K-best scheme used when USE_FCYC is set. A trace's
+ * time is accepted once the FCYC_K fastest of at most FCYC_MAXSAMPLES
+ * runs lie within a factor (1 + FCYC_EPSILON) of each other. With
+ * FCYC_CLEAR_CACHE set (the default, as before), FCYC_CACHE_BYTES of
+ * memory are read before every run so that each one starts with a cold
+ * cache; clear it to time warm-cache runs instead.
+ */
+#define FCYC_K            3
+#define FCYC_EPSILON      0.01
+#define FCYC_MAXSAMPLES   20
+#define FCYC_CLEAR_CACHE  1
+#define FCYC_CACHE_BYTES  (32*(1<<20))  /* 32 MB, larger than most LLCs */
+#define FCYC_CACHE_BLOCK  64
 
 #endif /* __CONFIG_H */
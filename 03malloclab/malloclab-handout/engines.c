@@ -0,0 +1,54 @@
+/*
+ * engines.c - Table of the allocators linked into the driver
+ *
+ * To add an allocator mm_foo.c, list it in ENGINES in the Makefile and
+ * add ENGINE(mm_foo) and an entry for it below.
+ */
+#include <string.h>
+
+#include "mm.h"
+#include "engines.h"
+
+/* Declares the renamed entry points of the engine built from file.c */
+#define ENGINE(file)						\
+    extern int file##_init(void);				\
+    extern void *file##_malloc(size_t size);			\
+    extern void file##_free(void *ptr);				\
+    extern void *file##_realloc(void *ptr, size_t size)
+
+/* Table entry for that engine */
+#define ENTRY(name, file) \
+    {name, file##_init, file##_malloc, file##_free, file##_realloc}
+
+ENGINE(mm_implicit);
+ENGINE(mm_implicit_ref);
+ENGINE(mm_explicit_ref);
+ENGINE(mm_seg);
+ENGINE(mm_segregate_ref);
+ENGINE(mm_seg_ref_98);
+
+engine_t engines[] = {
+    ENTRY("mm", mm),
+    ENTRY("implicit", mm_implicit),
+    ENTRY("implicit_ref", mm_implicit_ref),
+    ENTRY("explicit_ref", mm_explicit_ref),
+    ENTRY("seg", mm_seg),
+    ENTRY("segregate_ref", mm_segregate_ref),
+    ENTRY("seg_ref_98", mm_seg_ref_98),
+};
+int num_engines = sizeof(engines) / sizeof(engine_t);
+
+engine_t *mm_engine = &engines[0];
+
+/*
+ * find_engine - Look up an engine by name
+ */
+engine_t *find_engine(char *name)
+{
+    int i;
+
+    for (i = 0; i < num_engines; i++)
+	if (strcmp(engines[i].name, name) == 0)
+	    return &engines[i];
+    return NULL;
+}
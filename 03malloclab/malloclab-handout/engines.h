@@ -0,0 +1,30 @@
+#ifndef __ENGINES_H_
+#define __ENGINES_H_
+
+/*
+ * engines.h - The allocator implementations linked into the driver
+ *
+ * Every mm*.c in this directory is compiled with its mm_ entry points
+ * renamed after the file (mm_seg.c defines mm_seg_init, mm_seg_malloc,
+ * ...) and its other global symbols made local, so all of them can be
+ * linked into one mdriver. mm.c keeps its own names and is engines[0].
+ */
+#include <stddef.h>
+
+/* The entry points of one allocator */
+typedef struct {
+    char *name;                               /* e.g. "seg" for mm_seg.c */
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} engine_t;
+
+extern engine_t engines[];    /* every linked allocator, mm.c first */
+extern int num_engines;
+extern engine_t *mm_engine;   /* the allocator the driver calls */
+
+/* Look up an engine by name; NULL if there is none */
+engine_t *find_engine(char *name);
+
+#endif /* __ENGINES_H_ */
@@ -21,7 +21,7 @@
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
 #define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CACHE_BLOCK 64       /* Cache block size in bytes */
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
@@ -199,7 +199,7 @@ void set_fcyc_cache_size(int bytes)
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 64
  */
 void set_fcyc_cache_block(int bytes) {
     cache_block = bytes;
@@ -32,7 +32,7 @@ void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 64
  */
 void set_fcyc_cache_block(int bytes);
 
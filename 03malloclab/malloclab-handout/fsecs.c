@@ -23,12 +23,18 @@ void init_fsecs(void)
     if (verbose)
 	printf("Measuring performance with a cycle counter.\n");
 
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
+    /* 
+     * set key parameters for the fcyc package. The TSC is fenced and
+     * K-best already discards runs hit by interrupts, so there is no
+     * need to compensate for timer ticks.
+     */
+    set_fcyc_maxsamples(FCYC_MAXSAMPLES); 
+    set_fcyc_clear_cache(FCYC_CLEAR_CACHE);
+    set_fcyc_cache_size(FCYC_CACHE_BYTES);
+    set_fcyc_cache_block(FCYC_CACHE_BLOCK);
+    set_fcyc_compensate(0);
+    set_fcyc_epsilon(FCYC_EPSILON);
+    set_fcyc_k(FCYC_K);
     Mhz = mhz(verbose > 0);
 #elif USE_ITIMER
     if (verbose)
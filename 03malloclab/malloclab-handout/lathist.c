@@ -0,0 +1,125 @@
+/*
+ * lathist.c - Log-linear (HDR-style) latency histograms and the clock
+ *     used to fill them
+ */
+#include <string.h>
+#include <time.h>
+
+#include "lathist.h"
+
+/* Number of back-to-back timer reads used to estimate the overhead */
+#define OVHD_SAMPLES 1000
+
+/*
+ * bucket_of - Index of the bucket that counts val
+ */
+static int bucket_of(unsigned long long val)
+{
+    int msb;
+
+    if (val < HIST_SUB)
+	return (int)val;
+    msb = 63 - __builtin_clzll(val);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+	(int)(val >> (msb - HIST_SUB_BITS)) - HIST_SUB;
+}
+
+/*
+ * bucket_high - Largest value counted by bucket idx
+ */
+static unsigned long long bucket_high(int idx)
+{
+    int group = idx / HIST_SUB;
+    unsigned long long sub = idx % HIST_SUB;
+
+    if (group == 0)
+	return sub;
+    return ((HIST_SUB + sub + 1) << (group - 1)) - 1;
+}
+
+/*
+ * hist_reset - Empty a histogram
+ */
+void hist_reset(hist_t *h)
+{
+    memset(h, 0, sizeof(hist_t));
+}
+
+/*
+ * hist_add - Record one value
+ */
+void hist_add(hist_t *h, unsigned long long val)
+{
+    h->buckets[bucket_of(val)]++;
+    h->count++;
+    if (val > h->max)
+	h->max = val;
+}
+
+/*
+ * hist_merge - Add the counts of src into dst
+ */
+void hist_merge(hist_t *dst, hist_t *src)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+	dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+	dst->max = src->max;
+}
+
+/*
+ * hist_percentile - Return the smallest value v such that at least pct
+ *     percent of the recorded values are <= v, to within the bucket
+ *     resolution. The result never exceeds the exact maximum.
+ */
+unsigned long long hist_percentile(hist_t *h, double pct)
+{
+    unsigned long long target, seen = 0;
+    int i;
+
+    if (h->count == 0)
+	return 0;
+    target = (unsigned long long)(pct / 100.0 * h->count + 0.5);
+    if (target < 1)
+	target = 1;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	seen += h->buckets[i];
+	if (seen >= target)
+	    return (bucket_high(i) < h->max) ? bucket_high(i) : h->max;
+    }
+    return h->max;
+}
+
+/*
+ * lat_now - Current time in nanoseconds. CLOCK_MONOTONIC_RAW is not
+ *     slewed by NTP, so short intervals are not stretched or squeezed.
+ */
+unsigned long long lat_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * lat_overhead - Estimate the cost of timing an empty interval, so it
+ *     can be subtracted from each measured request
+ */
+unsigned long long lat_overhead(void)
+{
+    unsigned long long t0, t1, best = ~0ULL;
+    int i;
+
+    for (i = 0; i < OVHD_SAMPLES; i++) {
+	t0 = lat_now();
+	t1 = lat_now();
+	if (t1 - t0 < best)
+	    best = t1 - t0;
+    }
+    return best;
+}
@@ -0,0 +1,41 @@
+#ifndef __LATHIST_H_
+#define __LATHIST_H_
+
+/*
+ * lathist.h - Log-linear latency histograms
+ *
+ * Values below HIST_SUB are counted exactly; above that every power of
+ * two is split into HIST_SUB equal sub-buckets, so any recorded value
+ * is known to within 1/HIST_SUB (about 3%) over the whole 64-bit range
+ * while the histogram stays a fixed-size array of counters.
+ */
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    unsigned long long count;               /* number of values recorded */
+    unsigned long long max;                 /* largest value recorded */
+    unsigned long long buckets[HIST_BUCKETS];
+} hist_t;
+
+/* Empty a histogram */
+void hist_reset(hist_t *h);
+
+/* Record one value */
+void hist_add(hist_t *h, unsigned long long val);
+
+/* Add the counts of src into dst */
+void hist_merge(hist_t *dst, hist_t *src);
+
+/* Smallest value v such that pct percent of the values are <= v */
+unsigned long long hist_percentile(hist_t *h, double pct);
+
+/* Current time in nanoseconds from CLOCK_MONOTONIC_RAW */
+unsigned long long lat_now(void);
+
+/* Smallest observed cost of a pair of back-to-back lat_now() calls */
+unsigned long long lat_overhead(void);
+
+#endif /* __LATHIST_H_ */
@@ -20,6 +20,12 @@
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
+#include "mtreplay.h"
+#include "lathist.h"
+#include "perfctr.h"
+#include "engines.h"
+#include "bench.h"
 
 /**********************
  * Constants and macros
@@ -30,6 +36,25 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Utilization timeline (-u, -U) */
+#define TL_EVERY     100 /* default sampling interval, in requests */
+#define TL_MINLIVE  0.50 /* worst window needs this fraction of peak live */
+#define HOLE_MIN      32 /* wider gaps between payloads hold a free block */
+
+/* Payload-touching replay (-x) */
+#define TOUCH_READS    4 /* live blocks read back after each request */
+#define TOUCH_RING    16 /* recently allocated blocks remembered (2^k) */
+#define TOUCH_LINE    64 /* bytes apart of the reads within a block */
+#define TOUCH_SPAN  4096 /* most bytes of one block read back */
+
+/* Repeated timing runs (-R, -w, -o) */
+#define BENCH_REPS    10 /* default timed runs per trace with -o */
+#define BENCH_WARMUPS  1 /* default untimed runs before them */
+
+/* Interleaving traces on one heap (-m, -M, -n) */
+#define MIX_MAX       16 /* most traces interleaved */
+#define MIX_SEED       1 /* fixed, so that -M random is repeatable */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -37,30 +62,33 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The ranges of the live
+ * blocks form an AVL tree ordered by lo, so that a block can be added,
+ * removed, or checked for overlap in O(log n) time.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges with lower addresses */
+    struct range_t *right; /* ranges with higher addresses */
+    int height;            /* height of the subtree rooted here */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+/* Which live blocks the payload-touching replay reads back (-x) */
+enum {TOUCH_NONE, TOUCH_RECENT, TOUCH_RANDOM};
 
-/* Holds the information for one trace file*/
+/* Bookkeeping of the payload-touching replay */
 typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
+    int mode;              /* TOUCH_RECENT or TOUCH_RANDOM */
+    int *live;             /* ids of the live blocks, in no order... */
+    int *pos;              /* ... and the position of each id in live */
+    int nlive;
+    int ring[TOUCH_RING];  /* the most recently allocated ids */
+    int head;              /* next slot of ring */
+    unsigned seed;         /* for picking random blocks */
+    unsigned sink;         /* sum of the bytes read, so reads stay */
+} touch_t;
 
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
@@ -70,6 +98,7 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    touch_t *touch;  /* only for eval_touch */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -85,6 +114,30 @@ typedef struct {
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Per-request latency histograms for one trace (-H) */
+typedef struct {
+    int valid;       /* were the histograms filled in? */
+    hist_t hist[3];  /* one histogram per request type, indexed by type */
+} latency_t;
+
+/* One sample of the utilization timeline */
+typedef struct {
+    int op;          /* requests replayed so far */
+    size_t live;     /* live payload bytes */
+    size_t heap;     /* heap size in bytes */
+    int holes;       /* estimated number of free blocks */
+} sample_t;
+
+/* Summary of the utilization timeline of one trace (-u) */
+typedef struct {
+    int valid;       /* was the timeline sampled? */
+    int samples;     /* number of samples taken */
+    double avg_util; /* live payload over heap size, averaged over time */
+    double worst_util; /* lowest live payload over heap size in a window */
+    int worst_op;    /* the request that ended that window */
+    int max_holes;   /* most free blocks seen in one sample */
+} timeline_t;
+
 /********************
  * Global variables
  *******************/
@@ -95,6 +148,12 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* If set, the one "tracefile" is a list of traces to interleave (-m) */
+static int mixing = 0;
+static int mix_mode = MIX_RR;   /* in which order (-M) */
+static int mix_rounds = 1;      /* replays of each trace (-n) */
+static char *mix_list = NULL;   /* the traces given to -m, for errors */
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -105,31 +164,53 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate the range tree */
 static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum);
+		     trace_t *trace, int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
-
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
+static void eval_libc_latency(trace_t *trace, latency_t *lat);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, latency_t *lat);
+static void eval_mm_timeline(trace_t *trace, int tracenum, range_t **ranges,
+			     int every, FILE *csv, timeline_t *tl);
+static void touch_setup(touch_t *t, trace_t *trace, int mode);
+static void touch_cleanup(touch_t *t);
+static void eval_touch(void *ptr);
+static void eval_mm_bench(speed_t *speed, int reps, int warmups,
+			  bench_t *b);
+
+/* Reads a trace, or builds the interleaving of several (-m) */
+static trace_t *load_trace(char *name);
+
+/* Routines for running several allocators side by side (-a) */
+static int parse_engines(char *list, engine_t ***chosen);
+static void compare_engines(engine_t **chosen, int n, int touch,
+			    char **tracefiles, int num_tracefiles);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printlatency(int n, latency_t *lat);
+static void printperf(int n, perf_stats_t *perf, stats_t *stats);
+static void printtimeline(int n, timeline_t *tl, int every);
+static void printbench(int n, bench_t *b);
+static void printtouch(int n, stats_t *touch, perf_stats_t *perf,
+		       stats_t *stats);
+static void perf_index(double avg_util, double avg_throughput,
+		       double *p1, double *p2);
 static void usage(void);
 static void unix_error(char *msg);
-static void malloc_error(int tracenum, int opnum, char *msg);
+static void malloc_error(trace_t *trace, int tracenum, int opnum,
+			 char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -146,9 +227,36 @@ int main(int argc, char **argv)
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    mt_stats_t *libc_mt = NULL;/* libc threaded replay stats for each trace */
+    mt_stats_t *mm_mt = NULL;  /* mm threaded replay stats for each trace */
+    latency_t *libc_lat = NULL;/* libc latency histograms for each trace */
+    latency_t *mm_lat = NULL;  /* mm latency histograms for each trace */
+    perf_stats_t *libc_perf = NULL; /* libc hardware counts for each trace */
+    perf_stats_t *mm_perf = NULL;   /* mm hardware counts for each trace */
+    timeline_t *mm_tl = NULL;  /* mm utilization timelines for each trace */
+    FILE *tl_csv = NULL;       /* where -U writes the timeline samples */
+    stats_t *mm_touch = NULL;  /* mm payload-touching replay of each trace */
+    perf_stats_t *mm_touch_perf = NULL; /* and its hardware counts */
+    touch_t touch_state;       /* bookkeeping of that replay */
+    engine_t **chosen = NULL;  /* allocators to compare (-a) */
+    int num_chosen = 0;        /* the number of them */
+    bench_t *mm_bench = NULL;  /* mm repeated timing runs of each trace */
+    char *gov;                 /* frequency governor of the -c cpu */
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int nthreads = 0;    /* If set, also replay on this many threads (-T) */
+    int mt_mode = MT_SPLIT; /* How -T distributes a trace (-p) */
+    int latency = 0;     /* If set, print per-request latencies (-H) */
+    int perf = 0;        /* If set, print hardware counters per request (-P) */
+    int tl_every = 0;    /* If set, sample utilization this often (-u) */
+    char *tl_file = NULL;/* If set, write the samples to this CSV file (-U) */
+    int touch = TOUCH_NONE; /* If set, also replay touching payloads (-x) */
+    int counters = 0;    /* Are the hardware counters open? */
+    int reps = 0;        /* If set, time each trace this many times (-R) */
+    int warmups = -1;    /* Untimed runs before those (-w) */
+    int cpu = -1;        /* If set, pin to this cpu (-c) */
+    char *bench_file = NULL; /* If set, save the -R results here (-o) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -157,12 +265,16 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgl")) != EOF) {
+    while ((c = getopt(argc, argv, "a:c:f:t:hvVglT:p:HPu:U:x:R:w:o:m:M:n:")) != EOF) {
         switch (c) {
+	case 'a': /* Compare these allocators instead of running mm.c */
+	    num_chosen = parse_engines(optarg, &chosen);
+	    break;
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
         case 'f': /* Use one specific trace file only (relative to curr dir) */
+            mixing = 0;
             num_tracefiles = 1;
             if ((tracefiles = realloc(tracefiles, 2*sizeof(char *))) == NULL)
 		unix_error("ERROR: realloc failed in main");
@@ -170,8 +282,33 @@ int main(int argc, char **argv)
             tracefiles[0] = strdup(optarg);
             tracefiles[1] = NULL;
             break;
+	case 'm': /* Interleave these traces on one heap */
+	    mixing = 1;
+	    num_tracefiles = 1;
+	    if ((tracefiles = realloc(tracefiles, 2*sizeof(char *))) == NULL)
+		unix_error("ERROR: realloc failed in main");
+	    tracefiles[0] = strdup(optarg);
+	    tracefiles[1] = NULL;
+	    mix_list = tracefiles[0];
+	    break;
+	case 'M': /* Order of the interleaved requests */
+	    if (strcmp(optarg, "rr") == 0)
+		mix_mode = MIX_RR;
+	    else if (strcmp(optarg, "random") == 0)
+		mix_mode = MIX_RANDOM;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'n': /* Replay each interleaved trace this many times */
+	    if ((mix_rounds = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
 	case 't': /* Directory where the traces are located */
-	    if (num_tracefiles == 1) /* ignore if -f already encountered */
+	    if (num_tracefiles == 1 && !mixing) /* ignore if -f already encountered */
 		break;
 	    strcpy(tracedir, optarg);
 	    if (tracedir[strlen(tracedir)-1] != '/') 
@@ -180,6 +317,64 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+	case 'H': /* Histogram the latency of every request */
+	    latency = 1;
+	    break;
+	case 'P': /* Count hardware events during the speed runs */
+	    perf = 1;
+	    break;
+	case 'T': /* Replay each trace on this many threads as well */
+	    if ((nthreads = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'p': /* How the threads of -T share a trace */
+	    if ((mt_mode = mt_parse_mode(optarg)) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'u': /* Sample utilization every so many requests */
+	    if ((tl_every = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'U': /* Write the utilization samples to a CSV file */
+	    tl_file = optarg;
+	    break;
+	case 'x': /* Also replay touching the payloads */
+	    if (strcmp(optarg, "recent") == 0)
+		touch = TOUCH_RECENT;
+	    else if (strcmp(optarg, "random") == 0)
+		touch = TOUCH_RANDOM;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'R': /* Time each trace this many times */
+	    if ((reps = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'w': /* Untimed warmup runs before the -R runs */
+	    if ((warmups = atoi(optarg)) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'c': /* Pin to this cpu and ask for a fixed clock */
+	    if ((cpu = atoi(optarg)) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'o': /* Save the -R results to this CSV or JSON file */
+	    bench_file = optarg;
+	    break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -195,6 +390,20 @@ int main(int argc, char **argv)
         }
     }
 
+    if (nthreads && mt_mode == MT_PRODCONS && nthreads % 2 != 0)
+	app_error("-p prodcons needs an even number of threads (-T)");
+    if (num_chosen > 0 && (nthreads || latency || perf || tl_every ||
+			   tl_file || reps || bench_file || run_libc ||
+			   autograder))
+	app_error("-a cannot be combined with -T, -H, -P, -u, -U, -R, -o, "
+		  "-l or -g");
+    if (tl_file && !tl_every)
+	tl_every = TL_EVERY;
+    if (bench_file && !reps)
+	reps = BENCH_REPS;
+    if (warmups < 0)
+	warmups = BENCH_WARMUPS;
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -205,9 +414,33 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* 
+     * Pin to one cpu before anything is timed. The governor can only
+     * be changed by root, and is put back when we exit; otherwise we
+     * just report it, since anything but a fixed clock makes the
+     * timings noisier.
+     */
+    if (cpu >= 0) {
+	if (bench_pin(cpu) < 0)
+	    unix_error("Could not pin to the -c cpu");
+	if ((gov = bench_governor(cpu, 1)) == NULL)
+	    printf("Pinned to cpu %d (frequency governor unknown)\n", cpu);
+	else
+	    printf("Pinned to cpu %d (frequency governor %s%s)\n", cpu, gov,
+		   strcmp(gov, "performance") ? ", timings may drift" : "");
+    }
+
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Open the hardware counters, if asked to (-x counts cache misses) */
+    if (perf || touch) {
+	if ((counters = perf_open()) == 0) {
+	    printf("Hardware counters unavailable: %s\n", strerror(errno));
+	    perf = 0;
+	}
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -219,10 +452,23 @@ int main(int argc, char **argv)
 	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
 	if (libc_stats == NULL)
 	    unix_error("libc_stats calloc in main failed");
+	libc_mt = (mt_stats_t *)calloc(num_tracefiles, sizeof(mt_stats_t));
+	if (libc_mt == NULL)
+	    unix_error("libc_mt calloc in main failed");
+	if (latency &&
+	    (libc_lat = (latency_t *)calloc(num_tracefiles,
+					    sizeof(latency_t))) == NULL)
+	    unix_error("libc_lat calloc in main failed");
+	if (perf &&
+	    (libc_perf = (perf_stats_t *)calloc(num_tracefiles,
+						sizeof(perf_stats_t))) == NULL)
+	    unix_error("libc_perf calloc in main failed");
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (verbose > 1)
+		printf("Reading tracefile: %s\n", tracefiles[i]);
+	    trace = load_trace(tracefiles[i]);
 	    libc_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
@@ -232,6 +478,12 @@ int main(int argc, char **argv)
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		if (nthreads)
+		    mt_replay(trace, nthreads, mt_mode, MT_LIBC, &libc_mt[i]);
+		if (latency)
+		    eval_libc_latency(trace, &libc_lat[i]);
+		if (perf)
+		    perf_measure(eval_libc_speed, &speed_params, &libc_perf[i]);
 	    }
 	    free_trace(trace);
 	}
@@ -241,6 +493,29 @@ int main(int argc, char **argv)
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
 	}
+	if (nthreads) {
+	    printf("\nResults for libc malloc on %d threads (%s):\n",
+		   nthreads, mt_mode_name(mt_mode));
+	    mt_printresults(num_tracefiles, libc_mt);
+	    mt_freestats(num_tracefiles, libc_mt);
+	}
+	if (latency) {
+	    printf("\nRequest latencies for libc malloc (ns):\n");
+	    printlatency(num_tracefiles, libc_lat);
+	}
+	if (perf) {
+	    printf("\nHardware events per request for libc malloc:\n");
+	    printperf(num_tracefiles, libc_perf, libc_stats);
+	}
+    }
+
+    /*
+     * With -a, run the chosen allocators side by side and stop there
+     */
+    if (num_chosen > 0) {
+	mem_init();
+	compare_engines(chosen, num_chosen, touch, tracefiles, num_tracefiles);
+	exit(0);
     }
 
     /*
@@ -253,13 +528,45 @@ int main(int argc, char **argv)
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
+    mm_mt = (mt_stats_t *)calloc(num_tracefiles, sizeof(mt_stats_t));
+    if (mm_mt == NULL)
+	unix_error("mm_mt calloc in main failed");
+    if (latency &&
+	(mm_lat = (latency_t *)calloc(num_tracefiles,
+				      sizeof(latency_t))) == NULL)
+	unix_error("mm_lat calloc in main failed");
+    if (perf &&
+	(mm_perf = (perf_stats_t *)calloc(num_tracefiles,
+					  sizeof(perf_stats_t))) == NULL)
+	unix_error("mm_perf calloc in main failed");
+    if (tl_every &&
+	(mm_tl = (timeline_t *)calloc(num_tracefiles,
+				      sizeof(timeline_t))) == NULL)
+	unix_error("mm_tl calloc in main failed");
+    if (touch &&
+	((mm_touch = (stats_t *)calloc(num_tracefiles,
+				       sizeof(stats_t))) == NULL ||
+	 (mm_touch_perf = (perf_stats_t *)calloc(num_tracefiles,
+						 sizeof(perf_stats_t))) == NULL))
+	unix_error("mm_touch calloc in main failed");
+    if (reps &&
+	(mm_bench = (bench_t *)calloc(num_tracefiles,
+				      sizeof(bench_t))) == NULL)
+	unix_error("mm_bench calloc in main failed");
+    if (tl_file) {
+	if ((tl_csv = fopen(tl_file, "w")) == NULL)
+	    unix_error("Could not open the -U file");
+	fprintf(tl_csv, "trace,op,live_bytes,heap_bytes,util,holes\n");
+    }
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
+	if (verbose > 1)
+	    printf("Reading tracefile: %s\n", tracefiles[i]);
+	trace = load_trace(tracefiles[i]);
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
@@ -273,9 +580,36 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (reps)
+		eval_mm_bench(&speed_params, reps, warmups, &mm_bench[i]);
+	    if (nthreads)
+		mt_replay(trace, nthreads, mt_mode, MT_MM, &mm_mt[i]);
+	    if (latency)
+		eval_mm_latency(trace, &mm_lat[i]);
+	    if (perf)
+		perf_measure(eval_mm_speed, &speed_params, &mm_perf[i]);
+	    if (tl_every)
+		eval_mm_timeline(trace, i, &ranges, tl_every, tl_csv,
+				 &mm_tl[i]);
+	    if (touch) {
+		touch_setup(&touch_state, trace, touch);
+		speed_params.touch = &touch_state;
+		mm_touch[i].ops = trace->num_ops;
+		mm_touch[i].secs = fsecs(eval_touch, &speed_params);
+		mm_touch[i].valid = 1;
+		if (counters)
+		    perf_measure(eval_touch, &speed_params, &mm_touch_perf[i]);
+		touch_cleanup(&touch_state);
+	    }
+	}
+	if (reps) {
+	    strncpy(mm_bench[i].trace, tracefiles[i], BENCH_NAMELEN - 1);
+	    mm_bench[i].ops = trace->num_ops;
 	}
 	free_trace(trace);
     }
+    if (tl_csv && fclose(tl_csv) != 0)
+	unix_error("Could not write the -U file");
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -283,6 +617,46 @@ int main(int argc, char **argv)
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (reps) {
+	printf("Timing of mm malloc over %d runs (%d warmup%s):\n",
+	       reps, warmups, warmups == 1 ? "" : "s");
+	printbench(num_tracefiles, mm_bench);
+	printf("\n");
+	if (bench_file &&
+	    bench_write(bench_file, mm_bench, num_tracefiles) != 0)
+	    unix_error("Could not write the -o file");
+    }
+    if (nthreads) {
+	printf("Results for mm malloc on %d threads (%s, serialized):\n",
+	       nthreads, mt_mode_name(mt_mode));
+	mt_printresults(num_tracefiles, mm_mt);
+	mt_freestats(num_tracefiles, mm_mt);
+	printf("\n");
+    }
+    if (latency) {
+	printf("Request latencies for mm malloc (ns):\n");
+	printlatency(num_tracefiles, mm_lat);
+	printf("\n");
+    }
+    if (perf) {
+	printf("Hardware events per request for mm malloc:\n");
+	printperf(num_tracefiles, mm_perf, mm_stats);
+	printf("\n");
+    }
+    if (touch) {
+	printf("Payload-touching replay of mm malloc (%s blocks read):\n",
+	       touch == TOUCH_RECENT ? "recent" : "random");
+	printtouch(num_tracefiles, mm_touch, mm_touch_perf, mm_stats);
+	printf("\n");
+    }
+    if (counters)
+	perf_close();
+    if (tl_every) {
+	printf("Utilization over time for mm malloc (every %d requests):\n",
+	       tl_every);
+	printtimeline(num_tracefiles, mm_tl, tl_every);
+	printf("\n");
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -306,15 +680,7 @@ int main(int argc, char **argv)
     if (errors == 0) {
 	avg_mm_throughput = ops/secs;
 
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-	    p2 = (double)(1.0 - UTIL_WEIGHT);
-	} 
-	else {
-	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
-	}
-	
+	perf_index(avg_mm_util, avg_mm_throughput, &p1, &p2);
 	perfindex = (p1 + p2)*100.0;
 	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
 	       p1*100, 
@@ -337,19 +703,157 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/* Height of a (possibly empty) subtree */
+#define HEIGHT(r) ((r) ? (r)->height : 0)
+
+/*
+ * fix_height - Recompute the height of r from its children
+ */
+static void fix_height(range_t *r)
+{
+    int hl = HEIGHT(r->left), hr = HEIGHT(r->right);
+
+    r->height = ((hl > hr) ? hl : hr) + 1;
+}
+
+/*
+ * rotate_right, rotate_left - Single AVL rotations; return the new
+ *     root of the subtree
+ */
+static range_t *rotate_right(range_t *r)
+{
+    range_t *l = r->left;
+
+    r->left = l->right;
+    l->right = r;
+    fix_height(r);
+    fix_height(l);
+    return l;
+}
+
+static range_t *rotate_left(range_t *r)
+{
+    range_t *rr = r->right;
+
+    r->right = rr->left;
+    rr->left = r;
+    fix_height(r);
+    fix_height(rr);
+    return rr;
+}
+
+/*
+ * rebalance - Restore the AVL property at r after one of its subtrees
+ *     grew or shrank by one level; returns the new subtree root
+ */
+static range_t *rebalance(range_t *r)
+{
+    int balance;
+
+    fix_height(r);
+    balance = HEIGHT(r->left) - HEIGHT(r->right);
+    if (balance > 1) {
+	if (HEIGHT(r->left->left) < HEIGHT(r->left->right))
+	    r->left = rotate_left(r->left);
+	return rotate_right(r);
+    }
+    if (balance < -1) {
+	if (HEIGHT(r->right->right) < HEIGHT(r->right->left))
+	    r->right = rotate_right(r->right);
+	return rotate_left(r);
+    }
+    return r;
+}
+
+/*
+ * insert_node - Insert node p into the subtree rooted at r
+ */
+static range_t *insert_node(range_t *r, range_t *p)
+{
+    if (r == NULL)
+	return p;
+    if (p->lo < r->lo)
+	r->left = insert_node(r->left, p);
+    else
+	r->right = insert_node(r->right, p);
+    return rebalance(r);
+}
+
+/*
+ * remove_min - Unlink the lowest range of the subtree rooted at r and
+ *     return it in *min
+ */
+static range_t *remove_min(range_t *r, range_t **min)
+{
+    if (r->left == NULL) {
+	*min = r;
+	return r->right;
+    }
+    r->left = remove_min(r->left, min);
+    return rebalance(r);
+}
+
+/*
+ * remove_node - Remove and free the range starting at lo from the
+ *     subtree rooted at r, if there is one
+ */
+static range_t *remove_node(range_t *r, char *lo)
+{
+    range_t *succ;
+
+    if (r == NULL)
+	return NULL;
+    if (lo < r->lo)
+	r->left = remove_node(r->left, lo);
+    else if (lo > r->lo)
+	r->right = remove_node(r->right, lo);
+    else {
+	if (r->left == NULL || r->right == NULL) {
+	    succ = r->left ? r->left : r->right;
+	    free(r);
+	    return succ;
+	}
+	r->right = remove_min(r->right, &succ);
+	succ->left = r->left;
+	succ->right = r->right;
+	free(r);
+	r = succ;
+    }
+    return rebalance(r);
+}
+
+/*
+ * find_floor - Return the range with the highest lo that is <= addr,
+ *     or NULL if there is none
+ */
+static range_t *find_floor(range_t *r, char *addr)
+{
+    range_t *best = NULL;
+
+    while (r != NULL) {
+	if (r->lo <= addr) {
+	    best = r;
+	    r = r->right;
+	}
+	else
+	    r = r->left;
+    }
+    return best;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum)
+		     trace_t *trace, int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
@@ -361,7 +865,7 @@ static int add_range(range_t **ranges, char *lo, int size,
     if (!IS_ALIGNED(lo)) {
 	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
 		lo, ALIGNMENT);
-        malloc_error(tracenum, opnum, msg);
+        malloc_error(trace, tracenum, opnum, msg);
         return 0;
     }
 
@@ -370,31 +874,33 @@ static int add_range(range_t **ranges, char *lo, int size,
 	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
-	malloc_error(tracenum, opnum, msg);
+	malloc_error(trace, tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. The live ranges
+     * are disjoint, so the only one that can overlap [lo, hi] is the
+     * last one starting at or before hi.
+     */
+    if ((p = find_floor(*ranges, hi)) != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(trace, tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    p->height = 1;
+    *ranges = insert_node(*ranges, p);
     return 1;
 }
 
@@ -403,138 +909,30 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    *ranges = remove_node(*ranges, lo);
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * free_ranges - free every range record in the subtree rooted at r
  */
-static void clear_ranges(range_t **ranges)
+static void free_ranges(range_t *r)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
-    *ranges = NULL;
+    if (r == NULL)
+	return;
+    free_ranges(r->left);
+    free_ranges(r->right);
+    free(r);
 }
 
-
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
-
 /*
- * read_trace - read a trace file and store it in memory
+ * clear_ranges - free all of the range records for a trace 
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void clear_ranges(range_t **ranges)
 {
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
-
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
-
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
+    free_ranges(*ranges);
+    *ranges = NULL;
 }
 
-/*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
- */
-void free_trace(trace_t *trace)
-{
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
-}
 
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
@@ -559,8 +957,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
-	malloc_error(tracenum, 0, "mm_init failed.");
+    if (mm_engine->init() < 0) {
+	malloc_error(trace, tracenum, 0, "mm_init failed.");
 	return 0;
     }
 
@@ -574,8 +972,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    if ((p = mm_engine->malloc(size)) == NULL) {
+		malloc_error(trace, tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
 	    
@@ -584,7 +982,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * to the range list if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(ranges, p, size, trace, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -603,8 +1001,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
-		malloc_error(tracenum, i, "mm_realloc failed.");
+	    if ((newp = mm_engine->realloc(oldp, size)) == NULL) {
+		malloc_error(trace, tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
 	    
@@ -612,7 +1010,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    remove_range(ranges, oldp);
 	    
 	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    if (add_range(ranges, newp, size, trace, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -623,8 +1021,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
-		malloc_error(tracenum, i, "mm_realloc did not preserve the "
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
+		malloc_error(trace, tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
 	      }
@@ -641,7 +1039,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    mm_engine->free(p);
 	    break;
 
 	default:
@@ -677,7 +1075,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (mm_engine->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -687,7 +1085,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = mm_engine->malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -709,7 +1107,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = mm_engine->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -730,7 +1128,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    mm_engine->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -760,7 +1158,7 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (mm_engine->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -770,7 +1168,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = mm_engine->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -779,7 +1177,7 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = mm_engine->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -787,7 +1185,7 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            mm_engine->free(block);
             break;
 
 	default:
@@ -795,6 +1193,552 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_latency - Replay the trace on the mm package once more,
+ *    timing every request on its own, and histogram the latencies
+ *    by request type. The cost of reading the clock is subtracted.
+ */
+static void eval_mm_latency(trace_t *trace, latency_t *lat)
+{
+    int i, index;
+    char *p = NULL;
+    unsigned long long t0, t1, ovhd;
+
+    for (i = 0; i < 3; i++)
+	hist_reset(&lat->hist[i]);
+    ovhd = lat_overhead();
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_engine->init() < 0)
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	t0 = lat_now();
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+	    p = mm_engine->malloc(trace->ops[i].size);
+	    break;
+	case REALLOC: /* mm_realloc */
+	    p = mm_engine->realloc(trace->blocks[index], trace->ops[i].size);
+	    break;
+        case FREE: /* mm_free */
+	    mm_engine->free(trace->blocks[index]);
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	}
+	t1 = lat_now();
+
+	if (trace->ops[i].type != FREE) {
+	    if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+	    trace->blocks[index] = p;
+	}
+	hist_add(&lat->hist[trace->ops[i].type],
+		 (t1 - t0 > ovhd) ? t1 - t0 - ovhd : 0);
+    }
+    lat->valid = 1;
+}
+
+/*
+ * touch_setup, touch_cleanup - Allocate and free the bookkeeping of a
+ *    payload-touching replay of trace
+ */
+static void touch_setup(touch_t *t, trace_t *trace, int mode)
+{
+    t->mode = mode;
+    t->live = (int *)malloc(trace->num_ids * sizeof(int));
+    t->pos = (int *)malloc(trace->num_ids * sizeof(int));
+    if (t->live == NULL || t->pos == NULL)
+	unix_error("malloc failed in touch_setup");
+}
+
+static void touch_cleanup(touch_t *t)
+{
+    free(t->live);
+    free(t->pos);
+}
+
+/*
+ * touch_read - Read TOUCH_READS live blocks, one byte per cache line
+ *    of their first TOUCH_SPAN bytes.
+ *    TOUCH_RECENT reads the most recently allocated blocks that are
+ *    still live, TOUCH_RANDOM reads blocks picked uniformly at random.
+ */
+static void touch_read(trace_t *trace, touch_t *t)
+{
+    int k, j, id, size;
+    unsigned char *p;
+    unsigned sum = 0;
+
+    for (k = 0; k < TOUCH_READS && t->nlive > 0; k++) {
+	if (t->mode == TOUCH_RECENT) {
+	    id = t->ring[(t->head - 1 - k) & (TOUCH_RING - 1)];
+	    if (id < 0 || trace->blocks[id] == NULL)
+		continue;
+	}
+	else {
+	    t->seed ^= t->seed << 13;    /* xorshift32 */
+	    t->seed ^= t->seed >> 17;
+	    t->seed ^= t->seed << 5;
+	    id = t->live[t->seed % t->nlive];
+	}
+	p = (unsigned char *)trace->blocks[id];
+	size = trace->block_sizes[id];
+	if (size > TOUCH_SPAN)
+	    size = TOUCH_SPAN;
+	for (j = 0; j < size; j += TOUCH_LINE)
+	    sum += p[j];
+    }
+    t->sink += sum;
+}
+
+/*
+ * eval_touch - Replay the trace on an allocator the way a program
+ *    would use the memory: every new payload is written in full, the
+ *    grown part of a realloc'd block is written, and after each request
+ *    some live blocks are read back (see touch_read). Timed by fcyc
+ *    like eval_mm_speed, so the cost of the allocator's block placement
+ *    on the cache shows up in the running time.
+ */
+static void eval_touch(void *ptr)
+{
+    int i, index, size, oldsize, last;
+    char *p;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    touch_t *t = ((speed_t *)ptr)->touch;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_engine->init() < 0)
+	app_error("mm_init failed in eval_touch");
+    t->nlive = 0;
+    t->head = 0;
+    t->seed = 1;
+    for (i = 0; i < TOUCH_RING; i++)
+	t->ring[i] = -1;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+	    if ((p = mm_engine->malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_touch");
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    t->pos[index] = t->nlive;
+	    t->live[t->nlive++] = index;
+	    t->ring[t->head++ & (TOUCH_RING - 1)] = index;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    oldsize = trace->block_sizes[index];
+	    if ((p = mm_engine->realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc error in eval_touch");
+	    if (size > oldsize)
+		memset(p + oldsize, index & 0xFF, size - oldsize);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    t->ring[t->head++ & (TOUCH_RING - 1)] = index;
+	    break;
+
+        case FREE: /* mm_free */
+	    mm_engine->free(trace->blocks[index]);
+	    trace->blocks[index] = NULL;
+	    last = t->live[--t->nlive];    /* swap-remove from live[] */
+	    t->live[t->pos[index]] = last;
+	    t->pos[last] = t->pos[index];
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_touch");
+        }
+	touch_read(trace, t);
+    }
+}
+
+/*
+ * eval_mm_bench - Time eval_mm_speed reps times, after warmups untimed
+ *    runs that fault in the heap and warm the caches. Unlike fcyc,
+ *    which keeps the best time, every run is kept so that the spread
+ *    can be reported and two builds compared with some confidence.
+ */
+static void eval_mm_bench(speed_t *speed, int reps, int warmups,
+			  bench_t *b)
+{
+    unsigned long long t0;
+    double *samples;
+    int i;
+
+    if ((samples = (double *)malloc(reps * sizeof(double))) == NULL)
+	unix_error("samples malloc in eval_mm_bench failed");
+    for (i = 0; i < warmups; i++)
+	eval_mm_speed(speed);
+    for (i = 0; i < reps; i++) {
+	t0 = lat_now();
+	eval_mm_speed(speed);
+	samples[i] = (lat_now() - t0) / 1e9;
+    }
+    bench_summarize(samples, reps, b);
+    free(samples);
+}
+
+/*
+ * count_holes - Count the gaps wider than HOLE_MIN between the live
+ *    payloads of the subtree r, visited in address order; *end is the
+ *    first byte after the previous payload
+ */
+static int count_holes(range_t *r, char **end)
+{
+    int n;
+
+    if (r == NULL)
+	return 0;
+    n = count_holes(r->left, end);
+    if (r->lo - *end > HOLE_MIN)
+	n++;
+    *end = r->hi + 1;
+    return n + count_holes(r->right, end);
+}
+
+/*
+ * eval_mm_timeline - Replay the trace on the mm package once more and
+ *    sample the live payload, the heap size and the number of free
+ *    extents every `every' requests. Free blocks are invisible to the
+ *    driver, so a gap between neighboring payloads (or at either end
+ *    of the heap) wider than HOLE_MIN counts as one. The samples are
+ *    summarized in tl and, if csv is not NULL, written to it.
+ */
+static void eval_mm_timeline(trace_t *trace, int tracenum, range_t **ranges,
+			     int every, FILE *csv, timeline_t *tl)
+{
+    int i, j, index, size, oldsize, nsamples, last;
+    char *p, *newp, *end;
+    size_t live = 0, peak = 0;
+    double u, live_sum = 0, heap_sum = 0;
+    sample_t *samples, *s;
+
+    nsamples = trace->num_ops / every + 1;
+    if ((samples = (sample_t *)calloc(nsamples, sizeof(sample_t))) == NULL)
+	unix_error("samples calloc in eval_mm_timeline failed");
+
+    /* Reset the heap, the range tree and the mm package */
+    clear_ranges(ranges);
+    mem_reset_brk();
+    if (mm_engine->init() < 0)
+	app_error("mm_init failed in eval_mm_timeline");
+
+    for (i = 0, j = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+	    if ((p = mm_engine->malloc(size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_timeline");
+	    add_range(ranges, p, size, trace, tracenum, i);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    live += size;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    oldsize = trace->block_sizes[index];
+	    if ((newp = mm_engine->realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_timeline");
+	    remove_range(ranges, trace->blocks[index]);
+	    add_range(ranges, newp, size, trace, tracenum, i);
+	    trace->blocks[index] = newp;
+	    trace->block_sizes[index] = size;
+	    live += size - oldsize;
+	    break;
+
+        case FREE: /* mm_free */
+	    remove_range(ranges, trace->blocks[index]);
+	    mm_engine->free(trace->blocks[index]);
+	    live -= trace->block_sizes[index];
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_timeline");
+        }
+	if (live > peak)
+	    peak = live;
+
+	if ((i + 1) % every == 0 || i == trace->num_ops - 1) {
+	    s = &samples[j++];
+	    s->op = i + 1;
+	    s->live = live;
+	    s->heap = mem_heapsize();
+	    end = mem_heap_lo();
+	    s->holes = count_holes(*ranges, &end);
+	    if ((char *)mem_heap_hi() + 1 - end > HOLE_MIN)
+		s->holes++;
+	}
+    }
+    nsamples = j;
+
+    /* 
+     * Weigh each sample by the number of requests it stands for. The
+     * worst window ignores samples with under TL_MINLIVE of the peak
+     * payload live, i.e. the start of the trace and the final frees.
+     */
+    tl->samples = nsamples;
+    tl->worst_util = 1.0;
+    tl->worst_op = 0;
+    tl->max_holes = 0;
+    for (j = 0, last = 0; j < nsamples; last = samples[j++].op) {
+	s = &samples[j];
+	live_sum += (double)s->live * (s->op - last);
+	heap_sum += (double)s->heap * (s->op - last);
+	u = s->heap ? (double)s->live / s->heap : 0;
+	if (s->live >= TL_MINLIVE * peak && u < tl->worst_util) {
+	    tl->worst_util = u;
+	    tl->worst_op = s->op;
+	}
+	if (s->holes > tl->max_holes)
+	    tl->max_holes = s->holes;
+	if (csv)
+	    fprintf(csv, "%d,%d,%lu,%lu,%.4f,%d\n", tracenum, s->op,
+		    (unsigned long)s->live, (unsigned long)s->heap, u,
+		    s->holes);
+    }
+    tl->avg_util = heap_sum ? live_sum / heap_sum : 0;
+    tl->valid = 1;
+    free(samples);
+}
+
+/*
+ * load_trace - Read one trace from tracedir. With -m, name is instead
+ *    a comma-separated list of traces, which are read and interleaved
+ *    into one long trace that runs on a single heap (see mix_traces),
+ *    so that the allocator sees several workloads at once rather than
+ *    a fresh heap for each.
+ */
+static trace_t *load_trace(char *name)
+{
+    trace_t *parts[MIX_MAX], *trace;
+    char *list, *part;
+    int i, n = 0;
+
+    if (!mixing) {
+	return read_trace(tracedir, name);
+    }
+
+    if ((list = strdup(name)) == NULL)
+	unix_error("strdup in load_trace failed");
+    for (part = strtok(list, ","); part != NULL; part = strtok(NULL, ",")) {
+	if (n == MIX_MAX)
+	    app_error("Too many traces given to -m");
+	parts[n++] = read_trace(tracedir, part);
+    }
+    if (n == 0)
+	app_error("No traces given to -m");
+    trace = mix_traces(parts, n, mix_rounds, mix_mode, MIX_SEED);
+    if (verbose > 1)
+	printf("Interleaved %d traces %d times (%s): %d requests\n", n,
+	       mix_rounds, mix_mode == MIX_RR ? "rr" : "random",
+	       trace->num_ops);
+    for (i = 0; i < n; i++)
+	free_trace(parts[i]);
+    free(list);
+    return trace;
+}
+
+/*
+ * parse_engines - Turn the argument of -a ("all", "list", or a comma
+ *    separated list of engine names) into an array of engines
+ */
+static int parse_engines(char *list, engine_t ***chosen)
+{
+    char *name;
+    int i, n = 0;
+
+    if (strcmp(list, "list") == 0) {
+	for (i = 0; i < num_engines; i++)
+	    printf("%s\n", engines[i].name);
+	exit(0);
+    }
+
+    if ((*chosen = (engine_t **)calloc(num_engines, sizeof(engine_t *)))
+	== NULL)
+	unix_error("chosen calloc in parse_engines failed");
+    if (strcmp(list, "all") == 0) {
+	for (i = 0; i < num_engines; i++)
+	    (*chosen)[i] = &engines[i];
+	return num_engines;
+    }
+
+    for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+	if (n == num_engines)
+	    app_error("Too many allocators given to -a");
+	if (((*chosen)[n++] = find_engine(name)) == NULL) {
+	    sprintf(msg, "Unknown allocator %s (try -a list)", name);
+	    app_error(msg);
+	}
+    }
+    return n;
+}
+
+/*
+ * compare_engines - Run every trace through each of the chosen
+ *    allocators in turn and print their utilization, throughput and
+ *    99th percentile request latency side by side. Each trace is read
+ *    only once, and every allocator is checked, measured and timed
+ *    exactly as mm.c would be. If touch is set, the throughput of the
+ *    payload-touching replay (-x) is shown as well.
+ */
+static void compare_engines(engine_t **chosen, int n, int touch,
+			    char **tracefiles, int num_tracefiles)
+{
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    latency_t lat;
+    touch_t touch_state;
+    stats_t *stats, *sum, *s;
+    unsigned long long *p99;
+    double *tsecs, *tsum;
+    hist_t *total, all;
+    double p1, p2;
+    int i, j, k, width = touch ? 30 : 22;
+
+    stats = (stats_t *)calloc(n * num_tracefiles, sizeof(stats_t));
+    sum = (stats_t *)calloc(n, sizeof(stats_t));
+    p99 = (unsigned long long *)calloc(n * num_tracefiles,
+				       sizeof(unsigned long long));
+    total = (hist_t *)calloc(n, sizeof(hist_t));
+    tsecs = (double *)calloc(n * num_tracefiles, sizeof(double));
+    tsum = (double *)calloc(n, sizeof(double));
+    if (stats == NULL || sum == NULL || p99 == NULL || total == NULL ||
+	tsecs == NULL || tsum == NULL)
+	unix_error("calloc in compare_engines failed");
+
+    for (i = 0; i < num_tracefiles; i++) {
+	if (verbose > 1)
+	    printf("Reading tracefile: %s\n", tracefiles[i]);
+	trace = load_trace(tracefiles[i]);
+	for (j = 0; j < n; j++) {
+	    mm_engine = chosen[j];
+	    s = &stats[j * num_tracefiles + i];
+	    s->ops = trace->num_ops;
+	    if (verbose > 1)
+		printf("Checking %s for correctness, ", mm_engine->name);
+	    s->valid = eval_mm_valid(trace, i, &ranges);
+	    if (!s->valid) {
+		if (verbose > 1)
+		    printf("\n");
+		continue;
+	    }
+	    if (verbose > 1)
+		printf("efficiency, ");
+	    s->util = eval_mm_util(trace, i, &ranges);
+	    speed_params.trace = trace;
+	    speed_params.ranges = ranges;
+	    if (verbose > 1)
+		printf("performance, and latency.\n");
+	    s->secs = fsecs(eval_mm_speed, &speed_params);
+
+	    /* One histogram over all request types */
+	    eval_mm_latency(trace, &lat);
+	    hist_reset(&all);
+	    for (k = 0; k < 3; k++)
+		hist_merge(&all, &lat.hist[k]);
+	    p99[j * num_tracefiles + i] = hist_percentile(&all, 99);
+	    hist_merge(&total[j], &all);
+
+	    if (touch) {
+		touch_setup(&touch_state, trace, touch);
+		speed_params.touch = &touch_state;
+		tsecs[j * num_tracefiles + i] = fsecs(eval_touch, &speed_params);
+		tsum[j] += tsecs[j * num_tracefiles + i];
+		touch_cleanup(&touch_state);
+	    }
+	}
+	free_trace(trace);
+    }
+    mm_engine = &engines[0];
+
+    /* The header: one column group per allocator */
+    printf("\nResults for %d allocators (util, Kops, p99 latency in ns%s):\n",
+	   n, touch ? ", Kops touching payloads" : "");
+    printf("%5s", "");
+    for (j = 0; j < n; j++)
+	printf("%*s", width, chosen[j]->name);
+    printf("\n%5s", "trace");
+    for (j = 0; j < n; j++) {
+	printf("%7s%8s%7s", "util", "Kops", "p99");
+	if (touch)
+	    printf("%8s", "xKops");
+    }
+    printf("\n");
+
+    /* One row per trace */
+    for (i = 0; i < num_tracefiles; i++) {
+	printf("%5d", i);
+	for (j = 0; j < n; j++) {
+	    s = &stats[j * num_tracefiles + i];
+	    if (s->valid)
+		printf("%6.0f%%%8.0f%7llu", s->util * 100.0,
+		       s->ops / 1e3 / s->secs, p99[j * num_tracefiles + i]);
+	    else
+		printf("%7s%8s%7s", "-", "-", "-");
+	    if (touch && s->valid)
+		printf("%8.0f", s->ops / 1e3 / tsecs[j * num_tracefiles + i]);
+	    else if (touch)
+		printf("%8s", "-");
+	}
+	printf("\n");
+    }
+
+    /* Totals and the performance index of every allocator */
+    for (j = 0; j < n; j++) {
+	s = &sum[j];
+	s->valid = 1;
+	for (i = 0; i < num_tracefiles; i++) {
+	    s->valid &= stats[j * num_tracefiles + i].valid;
+	    s->secs += stats[j * num_tracefiles + i].secs;
+	    s->ops += stats[j * num_tracefiles + i].ops;
+	    s->util += stats[j * num_tracefiles + i].util / num_tracefiles;
+	}
+    }
+    printf("%5s", "Total");
+    for (j = 0; j < n; j++) {
+	if (sum[j].valid)
+	    printf("%6.0f%%%8.0f%7llu", sum[j].util * 100.0,
+		   sum[j].ops / 1e3 / sum[j].secs,
+		   hist_percentile(&total[j], 99));
+	else
+	    printf("%7s%8s%7s", "-", "-", "-");
+	if (touch && sum[j].valid)
+	    printf("%8.0f", sum[j].ops / 1e3 / tsum[j]);
+	else if (touch)
+	    printf("%8s", "-");
+    }
+    printf("\n%5s", "Index");
+    for (j = 0; j < n; j++) {
+	if (sum[j].valid) {
+	    perf_index(sum[j].util, sum[j].ops / sum[j].secs, &p1, &p2);
+	    printf("%*.0f%%", width - 1, (p1 + p2) * 100.0);
+	}
+	else
+	    printf("%*s", width, "-");
+    }
+    printf("\n");
+
+    free(stats);
+    free(sum);
+    free(p99);
+    free(total);
+    free(tsecs);
+    free(tsum);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -811,7 +1755,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 
         case ALLOC: /* malloc */
 	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
+		malloc_error(trace, tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
 	    trace->blocks[trace->ops[i].index] = p;
@@ -821,7 +1765,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
 	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
+		malloc_error(trace, tracenum, i, "libc realloc failed");
 		unix_error("System message");
 	    }
 	    trace->blocks[trace->ops[i].index] = newp;
@@ -880,6 +1824,47 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*
+ * eval_libc_latency - Histogram the latency of every request issued
+ *    to libc malloc, as eval_mm_latency does for the mm package.
+ */
+static void eval_libc_latency(trace_t *trace, latency_t *lat)
+{
+    int i, index;
+    char *p = NULL;
+    unsigned long long t0, t1, ovhd;
+
+    for (i = 0; i < 3; i++)
+	hist_reset(&lat->hist[i]);
+    ovhd = lat_overhead();
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	t0 = lat_now();
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	    p = malloc(trace->ops[i].size);
+	    break;
+	case REALLOC: /* realloc */
+	    p = realloc(trace->blocks[index], trace->ops[i].size);
+	    break;
+        case FREE: /* free */
+	    free(trace->blocks[index]);
+	    break;
+	}
+	t1 = lat_now();
+
+	if (trace->ops[i].type != FREE) {
+	    if (p == NULL)
+		unix_error("malloc failed in eval_libc_latency");
+	    trace->blocks[index] = p;
+	}
+	hist_add(&lat->hist[trace->ops[i].type],
+		 (t1 - t0 > ovhd) ? t1 - t0 - ovhd : 0);
+    }
+    lat->valid = 1;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -942,6 +1927,173 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printlatency - prints the latency percentiles of each request type
+ *     for every trace whose histograms were filled in
+ */
+static void printlatency(int n, latency_t *lat)
+{
+    static char *names[] = {"malloc", "free", "realloc"};
+    static double pcts[] = {50, 90, 99, 99.9};
+    hist_t *h;
+    int i, j, k;
+
+    printf("%5s%8s%9s%8s%8s%8s%8s%9s\n",
+	   "trace", "op", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+	if (!lat[i].valid) {
+	    printf("%2d%11s%9s%8s%8s%8s%8s%9s\n",
+		   i, "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	for (j = 0; j < 3; j++) {
+	    h = &lat[i].hist[j];
+	    if (h->count == 0)
+		continue;
+	    printf("%2d%11s%9llu", i, names[j], h->count);
+	    for (k = 0; k < 4; k++)
+		printf("%8llu", hist_percentile(h, pcts[k]));
+	    printf("%9llu\n", h->max);
+	}
+    }
+}
+
+/*
+ * printperf - prints the hardware event counts of each trace's speed
+ *     run, divided by the number of requests in the trace
+ */
+static void printperf(int n, perf_stats_t *perf, stats_t *stats)
+{
+    int i, j;
+
+    printf("%5s", "trace");
+    for (j = 0; j < PERF_NEVENTS; j++)
+	printf("%10s", perf_event_name(j));
+    printf("%6s\n", "IPC");
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (j = 0; j < PERF_NEVENTS; j++) {
+	    if (perf[i].valid && perf[i].have[j])
+		printf("%10.2f", perf[i].counts[j] / stats[i].ops);
+	    else
+		printf("%10s", "-");
+	}
+	if (perf[i].valid && perf[i].have[PERF_INSTRUCTIONS] &&
+	    perf[i].have[PERF_CYCLES] && perf[i].counts[PERF_CYCLES] > 0)
+	    printf("%6.2f\n", perf[i].counts[PERF_INSTRUCTIONS] /
+		   perf[i].counts[PERF_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+}
+
+/*
+ * printtimeline - prints the summary of each trace's utilization
+ *     timeline and the time-weighted average over all the traces
+ */
+static void printtimeline(int n, timeline_t *tl, int every)
+{
+    int i, valid = 0;
+    double util = 0, worst = 1.0;
+
+    printf("%5s%9s%10s%12s%9s%11s\n",
+	   "trace", "samples", "avg util", "worst util", "at op", "max holes");
+    for (i = 0; i < n; i++) {
+	if (!tl[i].valid) {
+	    printf("%2d%12s%10s%12s%9s%11s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%12d%9.0f%%%11.0f%%%9d%11d\n", i, tl[i].samples,
+	       tl[i].avg_util * 100.0, tl[i].worst_util * 100.0,
+	       tl[i].worst_op, tl[i].max_holes);
+	util += tl[i].avg_util;
+	if (tl[i].worst_util < worst)
+	    worst = tl[i].worst_util;
+	valid++;
+    }
+    if (valid)
+	printf("%5s%19.0f%%%11.0f%%\n", "Total", util / valid * 100.0,
+	       worst * 100.0);
+}
+
+/*
+ * printtouch - prints the running time of each trace's payload-touching
+ *     replay, how much slower it was than the plain speed run, and its
+ *     cache and TLB misses per request
+ */
+static void printtouch(int n, stats_t *touch, perf_stats_t *perf,
+		       stats_t *stats)
+{
+    static int events[] = {PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_DTLB_MISSES};
+    int i, j;
+
+    printf("%5s%10s%8s%10s", "trace", "secs", "Kops", "slowdown");
+    for (j = 0; j < 3; j++)
+	printf("%10s", perf_event_name(events[j]));
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	if (!touch[i].valid) {
+	    printf("%2d%13s%8s%10s%10s%10s%10s\n",
+		   i, "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%13.6f%8.0f%9.2fx", i, touch[i].secs,
+	       touch[i].ops / 1e3 / touch[i].secs,
+	       touch[i].secs / stats[i].secs);
+	for (j = 0; j < 3; j++) {
+	    if (perf[i].valid && perf[i].have[events[j]])
+		printf("%10.2f", perf[i].counts[events[j]] / touch[i].ops);
+	    else
+		printf("%10s", "-");
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printbench - Print the repeated timings of mm malloc (-R). A trace
+ *     whose runs spread widely (MAD over 5% of the median) is marked,
+ *     as its numbers are not worth comparing.
+ */
+static void printbench(int n, bench_t *b)
+{
+    int i;
+
+    printf("%5s%12s%10s%22s%10s\n",
+	   "trace", "median(ms)", "MAD(ms)", "95% CI(ms)", "Kops");
+    for (i = 0; i < n; i++) {
+	if (b[i].reps == 0) {
+	    printf("%2d%15s\n", i, "-");
+	    continue;
+	}
+	printf("%2d%15.3f%10.3f%11.3f -%9.3f%10.0f%s\n",
+	       i,
+	       b[i].median * 1e3,
+	       b[i].mad * 1e3,
+	       b[i].ci_lo * 1e3,
+	       b[i].ci_hi * 1e3,
+	       b[i].ops / 1e3 / b[i].median,
+	       b[i].mad > 0.05 * b[i].median ? "  noisy" : "");
+    }
+}
+
+/*
+ * perf_index - Split the performance index for an average utilization
+ *     and throughput into its utilization and throughput parts
+ */
+static void perf_index(double avg_util, double avg_throughput,
+		       double *p1, double *p2)
+{
+    *p1 = UTIL_WEIGHT * avg_util;
+    if (avg_throughput > AVG_LIBC_THRUPUT) {
+	*p2 = (double)(1.0 - UTIL_WEIGHT);
+    } 
+    else {
+	*p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
+	    (avg_throughput/AVG_LIBC_THRUPUT);
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -961,12 +2113,33 @@ void unix_error(char *msg)
 }
 
 /*
- * malloc_error - Report an error returned by the mm_malloc package
+ * malloc_error - Report an error returned by the mm_malloc package. For
+ *     a -m trace the line is the request's line in the trace it came
+ *     from, which is named along with the replay (-n) it belongs to.
  */
-void malloc_error(int tracenum, int opnum, char *msg)
+void malloc_error(trace_t *trace, int tracenum, int opnum, char *msg)
 {
+    mixsrc_t *src;
+    char *name;
+    int k;
+
     errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    if (trace->src == NULL || mix_list == NULL || opnum >= trace->num_ops) {
+	printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum),
+	       msg);
+	return;
+    }
+
+    /* Find its trace in the list the way load_trace's strtok split it */
+    src = &trace->src[opnum];
+    name = mix_list + strspn(mix_list, ",");
+    for (k = 0; k < src->trace; k++) {
+	name += strcspn(name, ",");
+	name += strspn(name, ",");
+    }
+    printf("ERROR [trace %d, request %d: %.*s line %d, round %d]: %s\n",
+	   tracenum, opnum, (int)strcspn(name, ","), name,
+	   LINENUM(src->op), src->round + 1, msg);
 }
 
 /* 
@@ -974,13 +2147,33 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVgl] [-a <list>] [-f <file>] [-t <dir>] [-T <n> [-p <mode>]] [-HP]\n\t[-u <k>] [-U <file>] [-x <mode>]\n\t[-R <n> [-w <n>] [-o <file>]] [-c <cpu>]\n\t[-m <list> [-M <mode>] [-n <n>]]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-a <list>  Compare allocators instead: all, or names like\n");
+    fprintf(stderr, "\t           mm,seg (-a list shows the names). Takes -f, -m,\n");
+    fprintf(stderr, "\t           -t, -x and -c, but none of the other modes.\n");
+    fprintf(stderr, "\t-c <cpu>   Pin to <cpu> and try to fix its clock frequency.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Print per-request latency percentiles.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-M <mode>  Interleave -m traces in rr (default) or random order.\n");
+    fprintf(stderr, "\t-m <list>  Interleave the traces in <list> (like a,b,c) on one heap.\n");
+    fprintf(stderr, "\t-n <n>     Replay each -m trace <n> times (default 1).\n");
+    fprintf(stderr, "\t-o <file>  Save the -R timings to <file> (.json or CSV);\n");
+    fprintf(stderr, "\t           implies -R %d.\n", BENCH_REPS);
+    fprintf(stderr, "\t-P         Print hardware event counts per request.\n");
+    fprintf(stderr, "\t-p <mode>  Share traces among -T threads by: split (default),\n");
+    fprintf(stderr, "\t           copy, or prodcons (one allocates, one frees).\n");
+    fprintf(stderr, "\t-R <n>     Time each trace <n> times; print median, MAD, 95%% CI.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace on <n> pinned threads.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-U <file>  Write the -u samples to <file> as CSV.\n");
+    fprintf(stderr, "\t-u <k>     Sample utilization every <k> requests.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w <n>     Untimed warmup runs before the -R runs (default %d).\n", BENCH_WARMUPS);
+    fprintf(stderr, "\t-x <mode>  Also replay writing and reading payloads, reading\n");
+    fprintf(stderr, "\t           back recent or random live blocks.\n");
 }
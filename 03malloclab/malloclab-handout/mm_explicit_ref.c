@@ -63,8 +63,8 @@ int mm_init(void) {
         return -1;
     PUT(heap_listp, 0);
     PUT(heap_listp + (1*WSIZE), PACK(2*DSIZE, 1));
-    PUT(heap_listp + (2*WSIZE), heap_listp+(3*WSIZE));
-    PUT(heap_listp + (3*WSIZE), heap_listp+(2*WSIZE));
+    PUT(heap_listp + (2*WSIZE), (unsigned int)(heap_listp+(3*WSIZE)));
+    PUT(heap_listp + (3*WSIZE), (unsigned int)(heap_listp+(2*WSIZE)));
     PUT(heap_listp + (4*WSIZE), PACK(2*DSIZE, 1));
     PUT(heap_listp + (5*WSIZE), PACK(0,1));
     heap_listp += 2*WSIZE;
@@ -101,10 +101,6 @@ static void* extend_heap(size_t words) {
 }
 
 static void* find_fit(size_t asize) {
-    int findType = BEST_FIT;
-    size_t extendsize;
-    void* lastBlockPointer;
-
     // FIRST FIT
     
     // void* finderBp = heap_listp;
@@ -326,7 +322,7 @@ void mm_free(void *ptr)
 
     PUT(HDRP(ptr), PACK(size, 0));
     PUT(FTRP(ptr), PACK(size, 0));
-    void* fb = coalesce(ptr);
+    coalesce(ptr);
 }
 
 /*
@@ -64,7 +64,7 @@ static void *last_found;       // 이 변수는 다른 파일에서 여러번 
 
 static void *extend_heap(size_t words);
 static void *coalesce(void *bp);
-static void *first_fit(size_t asize);
+static void *first_fit(size_t asize) __attribute__((unused)); /* the alternative to next_fit */
 static void *next_fit(size_t asize);
 static void place(void *bp, size_t asize);
 
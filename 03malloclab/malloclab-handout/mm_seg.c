@@ -37,7 +37,7 @@
 #define PACK(size, alloc)   ((size) | (alloc))
 
 #define GET(p)      (*(unsigned int *)(p))
-#define PUT(p, val)   (*(unsigned int *)(p) = val)
+#define PUT(p, val)   (*(unsigned int *)(p) = (unsigned int)(val))
 
 #define GET_SIZE(p)     (GET(p) & ~0x7)
 #define GET_ALLOC(p)    (GET(p) & 0x1)
@@ -61,8 +61,8 @@
 #define PREDP(bp)   ((unsigned int *)bp)
 #define SUCCP(bp)   ((unsigned int *)((char *)bp + WSIZE))
 
-#define PRED_BLKP(bp)   (*((unsigned int *)bp))
-#define SUCC_BLKP(bp)   (*((unsigned int *)((char *)bp + WSIZE)))
+#define PRED_BLKP(bp)   ((void *)*((unsigned int *)bp))
+#define SUCC_BLKP(bp)   ((void *)*((unsigned int *)((char *)bp + WSIZE)))
 
 
 /*
@@ -103,7 +103,7 @@ static void** find_seglist (size_t asize) {
 }
 
 static void* find_fit_in_segindex (size_t segindex, size_t asize) {
-    void* finder_bp = *(unsigned int *)((char *)seg_listp + segindex * WSIZE);
+    void* finder_bp = (void *)*(unsigned int *)((char *)seg_listp + segindex * WSIZE);
 
     if (finder_bp == NULL) return NULL;
 
@@ -335,7 +335,7 @@ int mm_init(void)
     PUT(heap_listp + (3*WSIZE), PACK(0, 1));
     heap_listp += (2*WSIZE);
 
-    if (extend_heap(INIT_HEAP) == NULL)
+    if (extend_heap(INITCHUNKSIZE) == NULL)
         return -1;
     
     return 0;
@@ -397,15 +397,6 @@ void *mm_realloc(void *ptr, size_t size)
     void *newptr;
     size_t copySize;
 
-    size_t asize;
-    size_t extendsize;
-    size_t last_free_size;
-
-    if (size <= DSIZE)
-        asize = 2 * DSIZE;
-    else
-        asize = (size + DSIZE + (DSIZE - 1)) / DSIZE * DSIZE;
-    
     newptr = mm_malloc(size);
     if (newptr == NULL)
       return NULL;
@@ -104,7 +104,7 @@ int mm_init(void)
     heap_listp += (2*WSIZE);
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
     
-    if (extend_heap(INIT_HEAP) == NULL)
+    if (extend_heap(INITCHUNKSIZE) == NULL)
         return -1;  
     return 0;
 }
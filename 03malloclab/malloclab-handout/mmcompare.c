@@ -0,0 +1,109 @@
+/*
+ * mmcompare.c - Compare two sets of timings saved by mdriver -o
+ *
+ * A trace counts as slower (or faster) only if the 95% confidence
+ * intervals of its two medians do not overlap, and the medians differ
+ * by at least a threshold, so that run-to-run noise is not reported as
+ * a regression. Exits with status 2 if any trace got slower, so it can
+ * gate a build script.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bench.h"
+
+/* Smallest change in the median reported, in percent */
+#define MIN_CHANGE 1.0
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmcompare [-h] [-m <pct>] <old> <new>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-m <pct>   Ignore changes in the median under <pct> percent\n");
+    fprintf(stderr, "\t           (default %.0f).\n", MIN_CHANGE);
+}
+
+/*
+ * load - Read a result file or die
+ */
+static int load(char *path, bench_t **b)
+{
+    int n;
+
+    if ((n = bench_read(path, b)) < 0) {
+	fprintf(stderr, "Could not read %s: %s\n", path, strerror(errno));
+	exit(1);
+    }
+    if (n == 0) {
+	fprintf(stderr, "%s holds no timings\n", path);
+	exit(1);
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, j, nold, nnew;
+    int slower = 0, faster = 0;
+    double min_change = MIN_CHANGE, change;
+    bench_t *old, *new;
+    char *verdict;
+
+    while ((c = getopt(argc, argv, "hm:")) != EOF) {
+	switch (c) {
+	case 'm': /* Threshold for reporting a change */
+	    if ((min_change = atof(optarg)) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+    nold = load(argv[optind], &old);
+    nnew = load(argv[optind+1], &new);
+
+    printf("%-24s%12s%12s%9s\n", "trace", "old(ms)", "new(ms)", "change");
+    for (i = 0; i < nnew; i++) {
+	for (j = 0; j < nold; j++)
+	    if (strcmp(old[j].trace, new[i].trace) == 0)
+		break;
+	if (j == nold || old[j].reps == 0 || new[i].reps == 0) {
+	    printf("%-24s%12s%12s\n", new[i].trace, "-", "-");
+	    continue;  /* new trace, or one that failed in either run */
+	}
+
+	/* Significant: the confidence intervals are disjoint */
+	change = (new[i].median - old[j].median) / old[j].median * 100.0;
+	verdict = "";
+	if (change >= min_change && new[i].ci_lo > old[j].ci_hi) {
+	    verdict = "  SLOWER";
+	    slower++;
+	}
+	else if (-change >= min_change && new[i].ci_hi < old[j].ci_lo) {
+	    verdict = "  faster";
+	    faster++;
+	}
+	printf("%-24s%12.3f%12.3f%+8.1f%%%s\n", new[i].trace,
+	       old[j].median * 1e3, new[i].median * 1e3, change, verdict);
+    }
+    printf("%d slower, %d faster, %d unchanged or within noise\n",
+	   slower, faster, nnew - slower - faster);
+
+    free(old);
+    free(new);
+    exit(slower ? 2 : 0);
+}
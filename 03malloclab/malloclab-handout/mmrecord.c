@@ -0,0 +1,731 @@
+/*
+ * mmrecord.c - LD_PRELOAD interposer that records a program's heap
+ *     requests and writes them out as a malloc lab trace
+ *
+ * Usage:
+ *
+ *   unix> LD_PRELOAD=./libmmrecord.so MMRECORD_FILE=proxy.rep ./proxy 15213
+ *   unix> mdriver -V -f proxy.rep
+ *
+ * malloc, calloc, realloc, free, posix_memalign and aligned_alloc are
+ * wrapped. Each call appends one record (timestamp, thread, pointers,
+ * size) to a buffer owned by the calling thread, so the fast path takes
+ * no locks and makes no system calls. Buffers are mmap'd in chunks; a
+ * new chunk is pushed onto a global list with a compare-and-swap.
+ *
+ * When the program exits (or is stopped by SIGINT or SIGTERM), the
+ * records of all threads are sorted by timestamp, addresses are mapped
+ * to trace ids, and the trace is written. Blocks still live at that
+ * point are freed at the end so that the trace is balanced. The signal
+ * may interrupt a thread that holds the real allocator's lock, so this
+ * merge works only in mmap'd memory and writes with open/write: no
+ * stdio, qsort or getenv, which may call malloc or are not safe in a
+ * signal handler.
+ *
+ * Environment:
+ *   MMRECORD_FILE    output path; "%p" is replaced by the pid
+ *                    (default "mmrecord.%p.rep")
+ *   MMRECORD_BINARY  if set to 1, write a binary trace (also implied by
+ *                    a ".bin" suffix)
+ *
+ * Timestamps are taken after an allocation returns and before a free is
+ * issued, so a block's allocation always sorts before its free even if
+ * another thread frees it. A realloc races with other threads on its
+ * old address; if an address is handed out again while the merge still
+ * thinks it is live, the old block is freed first.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+
+/* Tunables */
+#define CHUNK_RECS  (1<<16)  /* records per buffer chunk */
+#define BOOT_BYTES  (1<<14)  /* static heap used while resolving symbols */
+#define MAXPATH     1024
+
+/* Kinds of records */
+enum {R_ALLOC, R_FREE, R_REALLOC};
+
+/* One recorded call */
+typedef struct {
+    unsigned long long ts;   /* CLOCK_MONOTONIC nanoseconds */
+    void *ptr;               /* block returned (or freed) */
+    void *old;               /* realloc's old block */
+    unsigned int size;       /* requested size, clamped to INT_MAX */
+    int tid;                 /* recorder's small thread id */
+    unsigned int seq;        /* order within the thread */
+    int type;                /* R_ALLOC, R_FREE or R_REALLOC */
+} rec_t;
+
+/* A buffer chunk filled by one thread */
+typedef struct chunk {
+    struct chunk *next;      /* link in the global chunk list */
+    int len;
+    rec_t recs[CHUNK_RECS];
+} chunk_t;
+
+/* Pointers to the real allocator */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+
+/* Global recorder state */
+static chunk_t *chunks;      /* every chunk ever filled (CAS push) */
+static int recording;        /* set once initialized, cleared at exit */
+static int resolving;        /* inside dlsym: serve from boot_heap */
+static int next_tid;
+static unsigned generation;  /* bumped in a forked child */
+static char out_name[MAXPATH] = "mmrecord.%p.rep";  /* MMRECORD_FILE */
+static int out_binary = -1;  /* MMRECORD_BINARY, -1 to go by suffix */
+static char boot_heap[BOOT_BYTES] __attribute__((aligned(16)));
+static size_t boot_used;
+
+/* Per-thread state */
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+static TLS chunk_t *cur_chunk;
+static TLS unsigned cur_gen;
+static TLS int my_tid;
+static TLS unsigned my_seq;
+static TLS int in_hook;      /* recursion guard */
+
+/* Function prototypes */
+static void record(int type, void *ptr, void *old, size_t size);
+static void resolve(void);
+static void *boot_alloc(size_t size);
+static int is_boot(void *ptr);
+static void on_fork_child(void);
+static void on_signal(int sig);
+static void finish(void);
+static int build_trace(rec_t *recs, long n, trace_t *trace);
+static int rec_cmp(const rec_t *x, const rec_t *y);
+static void sort_recs(rec_t *recs, rec_t *tmp, long n);
+static int write_out(trace_t *trace, char *path, int binary);
+static char *put_str(char *q, char *s);
+static char *put_int(char *q, long v);
+static void *map_alloc(size_t bytes);
+
+/*
+ * Hash table from live block address to trace id (open addressing,
+ * linear probing, backward-shift deletion); used only in finish()
+ */
+typedef struct {
+    void *key;
+    int id;
+} slot_t;
+
+static slot_t *table;
+static size_t table_mask;
+
+static int table_init(size_t nlive);
+static slot_t *table_find(void *key);
+static void table_remove(slot_t *s);
+
+/*
+ * init - Resolve the real allocator and start recording
+ */
+__attribute__((constructor))
+static void init(void)
+{
+    struct sigaction sa, old;
+    int sigs[] = {SIGINT, SIGTERM};
+    char *p;
+    int i;
+
+    resolve();
+    pthread_atfork(NULL, NULL, on_fork_child);
+
+    /* Read the environment now; finish() may run in a signal handler */
+    if ((p = getenv("MMRECORD_FILE")) != NULL && strlen(p) < MAXPATH)
+	strcpy(out_name, p);
+    if ((p = getenv("MMRECORD_BINARY")) != NULL)
+	out_binary = atoi(p);
+
+    /* Flush the trace on the usual ways of stopping a server, unless
+       the program has its own handlers (which then win anyway) */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0; i < 2; i++) {
+	if (sigaction(sigs[i], NULL, &old) == 0 && old.sa_handler == SIG_DFL)
+	    sigaction(sigs[i], &sa, NULL);
+    }
+    __atomic_store_n(&recording, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * fini - Write the trace when the program exits normally
+ */
+__attribute__((destructor))
+static void fini(void)
+{
+    finish();
+}
+
+/*
+ * The interposed allocator entry points
+ */
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL) {
+	if (resolving)
+	    return boot_alloc(size);
+	resolve();
+    }
+    p = real_malloc(size);
+    record(R_ALLOC, p, NULL, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL) {
+	if (resolving)
+	    return boot_alloc(nmemb * size);  /* boot_heap is zeroed */
+	resolve();
+    }
+    p = real_calloc(nmemb, size);
+    record(R_ALLOC, p, NULL, nmemb * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (is_boot(ptr)) {
+	/* Move a bootstrap block onto the real heap (untraced) */
+	size_t avail = boot_heap + BOOT_BYTES - (char *)ptr;
+
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, size < avail ? size : avail);
+	return p;
+    }
+    if (real_realloc == NULL)
+	resolve();
+    p = real_realloc(ptr, size);
+    record(R_REALLOC, p, ptr, size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_boot(ptr))
+	return;
+    if (real_free == NULL)
+	resolve();
+    record(R_FREE, ptr, NULL, 0);
+    real_free(ptr);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    int rc;
+
+    if (real_posix_memalign == NULL)
+	resolve();
+    rc = real_posix_memalign(memptr, alignment, size);
+    if (rc == 0)
+	record(R_ALLOC, *memptr, NULL, size);
+    return rc;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (real_aligned_alloc == NULL)
+	resolve();
+    p = real_aligned_alloc(alignment, size);
+    record(R_ALLOC, p, NULL, size);
+    return p;
+}
+
+/*
+ * record - Append one record to the calling thread's buffer
+ */
+static void record(int type, void *ptr, void *old, size_t size)
+{
+    struct timespec ts;
+    chunk_t *c;
+    rec_t *r;
+
+    if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE) || in_hook)
+	return;
+    in_hook = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    c = cur_chunk;
+    if (c == NULL || c->len == CHUNK_RECS || cur_gen != generation) {
+	if (my_tid == 0 || cur_gen != generation)
+	    my_tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+	if ((c = map_alloc(sizeof(chunk_t))) == NULL) {
+	    in_hook = 0;
+	    return;            /* out of memory: drop the record */
+	}
+	c->next = __atomic_load_n(&chunks, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&chunks, &c->next, c, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	    ;
+	cur_chunk = c;
+	cur_gen = generation;
+    }
+
+    r = &c->recs[c->len];
+    r->ts = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    r->ptr = ptr;
+    r->old = old;
+    r->size = (size > 0x7fffffff) ? 0x7fffffff : size;
+    r->tid = my_tid;
+    r->seq = my_seq++;
+    r->type = type;
+    /* Publish the record before the length that covers it */
+    __atomic_store_n(&c->len, c->len + 1, __ATOMIC_RELEASE);
+
+    in_hook = 0;
+}
+
+/*
+ * resolve - Look up the next definitions of the allocator functions.
+ *     dlsym itself may call calloc, which is served from boot_heap.
+ */
+static void resolve(void)
+{
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    resolving = 0;
+    if (real_malloc == NULL || real_calloc == NULL || real_realloc == NULL ||
+	real_free == NULL) {
+	fprintf(stderr, "mmrecord: cannot find the real allocator\n");
+	_exit(1);
+    }
+}
+
+/*
+ * boot_alloc, is_boot - Bump allocator for the few requests made
+ *     before the real allocator is known. Never freed.
+ */
+static void *boot_alloc(size_t size)
+{
+    size_t start = __atomic_fetch_add(&boot_used, (size + 15) & ~15UL,
+				      __ATOMIC_RELAXED);
+
+    if (start + size > BOOT_BYTES)
+	return NULL;
+    return boot_heap + start;
+}
+
+static int is_boot(void *ptr)
+{
+    return (char *)ptr >= boot_heap && (char *)ptr < boot_heap + BOOT_BYTES;
+}
+
+/*
+ * on_fork_child - A forked child starts an empty trace of its own;
+ *     blocks inherited from the parent are unknown to it, so their
+ *     frees are dropped at merge time
+ */
+static void on_fork_child(void)
+{
+    chunks = NULL;
+    next_tid = 0;
+    generation++;
+}
+
+/*
+ * on_signal - Write the trace, then die of the signal as we would have
+ */
+static void on_signal(int sig)
+{
+    finish();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/*
+ * finish - Stop recording, merge the per-thread buffers and write the
+ *     trace. Runs once, whichever of exit or a signal gets here first.
+ */
+static void finish(void)
+{
+    static int done;
+    char path[MAXPATH], msg[MAXPATH + 128], *p, *q;
+    int binary, *lens, nchunks, k;
+    chunk_t *head, *c;
+    rec_t *recs, *tmp;
+    long n, i;
+    trace_t trace;
+
+    if (__atomic_exchange_n(&done, 1, __ATOMIC_ACQ_REL))
+	return;
+    __atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+
+    /* Other threads may still be appending: take each chunk's length
+       once and copy exactly that many records */
+    head = __atomic_load_n(&chunks, __ATOMIC_ACQUIRE);
+    nchunks = 0;
+    for (c = head; c != NULL; c = c->next)
+	nchunks++;
+    n = 0;
+    if ((lens = map_alloc((nchunks + 1) * sizeof(int))) != NULL) {
+	for (c = head, k = 0; c != NULL; c = c->next, k++)
+	    n += lens[k] = __atomic_load_n(&c->len, __ATOMIC_ACQUIRE);
+    }
+    if (lens == NULL ||
+	(recs = map_alloc((n + 1) * sizeof(rec_t))) == NULL ||
+	(tmp = map_alloc((n + 1) * sizeof(rec_t))) == NULL) {
+	q = put_str(msg, "mmrecord: out of memory writing the trace\n");
+	write(STDERR_FILENO, msg, q - msg);
+	return;
+    }
+    i = 0;
+    for (c = head, k = 0; c != NULL; c = c->next, k++) {
+	memcpy(recs + i, c->recs, lens[k] * sizeof(rec_t));
+	i += lens[k];
+    }
+    sort_recs(recs, tmp, n);
+
+    if (build_trace(recs, n, &trace) < 0) {
+	q = put_str(msg, "mmrecord: out of memory writing the trace\n");
+	write(STDERR_FILENO, msg, q - msg);
+	return;
+    }
+
+    /* Expand the output path */
+    for (p = out_name, q = path; *p && q < path + MAXPATH - 16; p++) {
+	if (p[0] == '%' && p[1] == 'p') {
+	    q = put_int(q, getpid());
+	    p++;
+	}
+	else
+	    *q++ = *p;
+    }
+    *q = '\0';
+    binary = (out_binary >= 0) ? out_binary :
+	(q - path > 4 && strcmp(q - 4, ".bin") == 0);
+
+    if (write_out(&trace, path, binary) < 0) {
+	q = put_str(msg, "mmrecord: could not write ");
+	q = put_str(q, path);
+    }
+    else {
+	q = put_str(msg, "mmrecord: ");
+	q = put_int(q, trace.num_ops);
+	q = put_str(q, " requests from ");
+	q = put_int(q, next_tid);
+	q = put_str(q, " threads in ");
+	q = put_str(q, path);
+    }
+    q = put_str(q, "\n");
+    write(STDERR_FILENO, msg, q - msg);
+}
+
+/*
+ * build_trace - Turn the time-ordered records into trace requests,
+ *     numbering blocks in order of allocation. Returns -1 if there
+ *     is no memory for the requests or the address table.
+ */
+static int build_trace(rec_t *recs, long n, trace_t *trace)
+{
+    traceop_t *ops;
+    rec_t *r;
+    slot_t *s;
+    long i;
+    int nops = 0, nids = 0;
+
+    /* Each record makes at most two requests, and every block gets one
+       more for the final free */
+    if ((ops = map_alloc((3 * n + 1) * sizeof(traceop_t))) == NULL ||
+	table_init(n) < 0)
+	return -1;
+
+#define EMIT(t, i, sz) (ops[nops].type = (t), ops[nops].index = (i), \
+			ops[nops].size = (sz), nops++)
+
+    for (i = 0; i < n; i++) {
+	r = &recs[i];
+	switch (r->type) {
+	case R_ALLOC:
+	    if (r->ptr == NULL)
+		break;
+	    if ((s = table_find(r->ptr))->key != NULL) {
+		EMIT(FREE, s->id, 0);          /* missed free: see above */
+	    }
+	    s->key = r->ptr;
+	    s->id = nids++;
+	    EMIT(ALLOC, s->id, r->size ? r->size : 1);
+	    break;
+
+	case R_FREE:
+	    if ((s = table_find(r->ptr))->key == NULL)
+		break;                         /* not ours (e.g. pre-fork) */
+	    EMIT(FREE, s->id, 0);
+	    table_remove(s);
+	    break;
+
+	case R_REALLOC:
+	    if (r->ptr == NULL) {
+		/* Failed, or realloc(p, 0) freed p */
+		if (r->size == 0 && r->old != NULL &&
+		    (s = table_find(r->old))->key != NULL) {
+		    EMIT(FREE, s->id, 0);
+		    table_remove(s);
+		}
+		break;
+	    }
+	    if (r->old == NULL || (s = table_find(r->old))->key == NULL) {
+		/* realloc(NULL, n) or of a block we never saw */
+		r->type = R_ALLOC;
+		i--;
+		break;
+	    }
+	    EMIT(REALLOC, s->id, r->size ? r->size : 1);
+	    if (r->ptr != r->old) {
+		int id = s->id;
+		table_remove(s);
+		if ((s = table_find(r->ptr))->key != NULL) {
+		    EMIT(FREE, s->id, 0);
+		}
+		s->key = r->ptr;
+		s->id = id;
+	    }
+	    break;
+	}
+    }
+
+    /* Free whatever the program left allocated */
+    for (i = 0; i <= (long)table_mask; i++) {
+	if (table[i].key != NULL)
+	    EMIT(FREE, table[i].id, 0);
+    }
+#undef EMIT
+
+    trace->sugg_heapsize = 0;
+    trace->num_ids = nids;
+    trace->num_ops = nops;
+    trace->weight = 1;
+    trace->ops = ops;
+    return 0;
+}
+
+/*
+ * rec_cmp - Order records by time, then thread, then program order
+ */
+static int rec_cmp(const rec_t *x, const rec_t *y)
+{
+    if (x->ts != y->ts)
+	return x->ts < y->ts ? -1 : 1;
+    if (x->tid != y->tid)
+	return x->tid < y->tid ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+/*
+ * sort_recs - Stable bottom-up merge sort of n records through tmp
+ *     (qsort may allocate its scratch space with malloc)
+ */
+static void sort_recs(rec_t *recs, rec_t *tmp, long n)
+{
+    rec_t *src = recs, *dst = tmp, *t;
+    long width, lo, mid, hi, i, j, k;
+
+    for (width = 1; width < n; width *= 2) {
+	for (lo = 0; lo < n; lo += 2 * width) {
+	    mid = (lo + width < n) ? lo + width : n;
+	    hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+	    for (i = lo, j = mid, k = lo; k < hi; k++) {
+		if (i < mid && (j == hi || rec_cmp(&src[i], &src[j]) <= 0))
+		    dst[k] = src[i++];
+		else
+		    dst[k] = src[j++];
+	    }
+	}
+	t = src; src = dst; dst = t;
+    }
+    if (src != recs)
+	memcpy(recs, src, n * sizeof(rec_t));
+}
+
+/*
+ * write_out - Write the trace to path as a .rep file (binary == 0) or
+ *     binary trace, in the format of write_trace but without stdio
+ */
+static int write_out(trace_t *trace, char *path, int binary)
+{
+    tracehdr_t hdr;
+    traceop_t *op;
+    char *buf, *q;
+    size_t len, off;
+    ssize_t rc;
+    int fd, i;
+
+    if (binary) {
+	len = sizeof(hdr) + (size_t)trace->num_ops * sizeof(traceop_t);
+	if ((buf = map_alloc(len)) == NULL)
+	    return -1;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	hdr.version = TRACE_VERSION;
+	hdr.op_size = sizeof(traceop_t);
+	hdr.sugg_heapsize = trace->sugg_heapsize;
+	hdr.num_ids = trace->num_ids;
+	hdr.num_ops = trace->num_ops;
+	hdr.weight = trace->weight;
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), trace->ops,
+	       (size_t)trace->num_ops * sizeof(traceop_t));
+    }
+    else {
+	/* No line is longer than 32 bytes */
+	if ((buf = map_alloc(32 * ((size_t)trace->num_ops + 4))) == NULL)
+	    return -1;
+	q = buf;
+	q = put_int(q, trace->sugg_heapsize); *q++ = '\n';
+	q = put_int(q, trace->num_ids); *q++ = '\n';
+	q = put_int(q, trace->num_ops); *q++ = '\n';
+	q = put_int(q, trace->weight); *q++ = '\n';
+	for (i = 0; i < trace->num_ops; i++) {
+	    op = &trace->ops[i];
+	    *q++ = (op->type == ALLOC) ? 'a' : (op->type == REALLOC) ? 'r' : 'f';
+	    *q++ = ' ';
+	    q = put_int(q, op->index);
+	    if (op->type != FREE) {
+		*q++ = ' ';
+		q = put_int(q, op->size);
+	    }
+	    *q++ = '\n';
+	}
+	len = q - buf;
+    }
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+	return -1;
+    for (off = 0; off < len; off += rc) {
+	if ((rc = write(fd, buf + off, len - off)) < 0) {
+	    if (errno == EINTR) {
+		rc = 0;
+		continue;
+	    }
+	    close(fd);
+	    return -1;
+	}
+    }
+    return close(fd);
+}
+
+/*
+ * put_str, put_int - Append a string or a decimal number at q and
+ *     return the new end (no NUL)
+ */
+static char *put_str(char *q, char *s)
+{
+    while (*s)
+	*q++ = *s++;
+    return q;
+}
+
+static char *put_int(char *q, long v)
+{
+    char digits[24];
+    unsigned long u = (v < 0) ? -(unsigned long)v : (unsigned long)v;
+    int i = 0;
+
+    if (v < 0)
+	*q++ = '-';
+    do {
+	digits[i++] = '0' + u % 10;
+	u /= 10;
+    } while (u > 0);
+    while (i > 0)
+	*q++ = digits[--i];
+    return q;
+}
+
+/*
+ * table_init, table_find, table_remove - The address to id table.
+ *     table_find returns the key's slot, or the empty slot where it
+ *     would be inserted. table_init returns -1 if it cannot map the
+ *     table.
+ */
+static int table_init(size_t nlive)
+{
+    size_t size = 1024;
+
+    while (size < 2 * nlive)
+	size <<= 1;
+    if ((table = map_alloc(size * sizeof(slot_t))) == NULL)
+	return -1;
+    table_mask = size - 1;
+    return 0;
+}
+
+static size_t table_hash(void *key)
+{
+    unsigned long long h = (unsigned long long)(size_t)key;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h & table_mask;
+}
+
+static slot_t *table_find(void *key)
+{
+    size_t i = table_hash(key);
+
+    while (table[i].key != NULL && table[i].key != key)
+	i = (i + 1) & table_mask;
+    return &table[i];
+}
+
+static void table_remove(slot_t *s)
+{
+    size_t i = s - table, j = i, home;
+
+    /* Shift later members of the probe run back over the hole */
+    for (;;) {
+	j = (j + 1) & table_mask;
+	if (table[j].key == NULL)
+	    break;
+	home = table_hash(table[j].key);
+	if (((j - home) & table_mask) >= ((j - i) & table_mask)) {
+	    table[i] = table[j];
+	    i = j;
+	}
+    }
+    table[i].key = NULL;
+}
+
+/*
+ * map_alloc - Zeroed memory straight from the kernel, so that the
+ *     recorder never calls the allocator it is watching
+ */
+static void *map_alloc(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return (p == MAP_FAILED) ? NULL : p;
+}
@@ -0,0 +1,529 @@
+/*
+ * mtreplay.c - Replay a trace on several threads at once
+ *
+ * The driver's normal speed test runs a trace on one thread, which says
+ * nothing about how an allocator behaves under contention. Here a
+ * trace is replayed by nthreads threads, each pinned to its own cpu:
+ *
+ *   split    - requests are partitioned by block id, so every thread
+ *              gets a valid sub-trace and ids never cross threads.
+ *   copy     - every thread replays the whole trace on its own blocks.
+ *   prodcons - threads work in pairs. The producer issues the mallocs
+ *              and reallocs of its share of the trace and hands each
+ *              block to be freed to its consumer through a lock-free
+ *              single-producer/single-consumer queue.
+ *
+ * The mm engines are not thread-safe, so their calls are serialized by
+ * a global lock; libc malloc is called directly. Each replay is repeated
+ * REPS times and the best time of every thread (and of the whole run,
+ * first start to last finish) is kept. A request that fails (copy mode
+ * easily fills the simulated heap) stops the replay and marks the trace
+ * as failed, and the driver goes on with the next one.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <float.h>
+
+#include "mtreplay.h"
+#include "engines.h"
+#include "memlib.h"
+
+/* Default values */
+#define REPS 5               /* Number of times each replay is repeated */
+#define QUEUE_SLOTS 4096     /* Capacity of a producer/consumer queue */
+#define CACHE_LINE 64        /* Keeps queue indices on separate lines */
+
+/* What a replay thread does with its requests */
+enum {ROLE_ALL, ROLE_PRODUCER, ROLE_CONSUMER};
+
+/* The allocator under test */
+typedef struct {
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} allocator_t;
+
+/* Single-producer/single-consumer ring of blocks waiting to be freed */
+typedef struct {
+    char *slots[QUEUE_SLOTS];
+    unsigned head __attribute__((aligned(CACHE_LINE))); /* next to pop */
+    unsigned tail __attribute__((aligned(CACHE_LINE))); /* next to push */
+} queue_t;
+
+struct replay;
+
+/* State of one replay thread */
+typedef struct {
+    int id;
+    int cpu;
+    int role;
+    traceop_t *ops;          /* this thread's requests... */
+    int num_ops;             /* ... and how many there are */
+    char **blocks;           /* this thread's block pointers, by id */
+    double issued;           /* requests actually issued per rep */
+    double *start;           /* start time of each rep */
+    double *end;             /* end time of each rep */
+    queue_t *queue;          /* shared with the partner thread, if any */
+    struct replay *replay;
+    pthread_t tid;
+} worker_t;
+
+/* State shared by all threads of a replay */
+typedef struct replay {
+    int nthreads;
+    int alloc;               /* MT_MM or MT_LIBC */
+    allocator_t *allocator;
+    pthread_barrier_t barrier;
+    worker_t *workers;
+    int failed;              /* set by the first request that fails... */
+    int fail_thread;         /* ... on this thread ... */
+    int fail_op;             /* ... at this index of its requests */
+} replay_t;
+
+static char *mode_names[] = {"split", "copy", "prodcons", NULL};
+
+/* Function prototypes */
+static void *mm_malloc_locked(size_t size);
+static void mm_free_locked(void *ptr);
+static void *mm_realloc_locked(void *ptr, size_t size);
+static void queue_push(queue_t *q, char *p);
+static char *queue_pop(queue_t *q);
+static void *worker_thread(void *vargp);
+static void run_ops(worker_t *w);
+static void fail(worker_t *w, int op);
+static void run_consumer(worker_t *w);
+static traceop_t *partition(trace_t *trace, int k, int n, int *num_ops);
+static double now(void);
+static void mt_error(char *msg);
+
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static allocator_t mm_locked = {
+    mm_malloc_locked, mm_free_locked, mm_realloc_locked
+};
+
+static allocator_t libc = {
+    malloc, free, realloc
+};
+
+/*
+ * mt_parse_mode - Parse a mode name; returns -1 if unknown
+ */
+int mt_parse_mode(char *name)
+{
+    int i;
+
+    for (i = 0; mode_names[i] != NULL; i++)
+	if (!strcmp(name, mode_names[i]))
+	    return i;
+    return -1;
+}
+
+/*
+ * mt_mode_name - Name of a replay mode
+ */
+char *mt_mode_name(int mode)
+{
+    return mode_names[mode];
+}
+
+/*
+ * mt_replay - Replay trace on nthreads pinned threads using the given
+ *     distribution mode and allocator, and record the best per-thread
+ *     and aggregate times in stats. MT_PRODCONS needs an even nthreads.
+ */
+void mt_replay(trace_t *trace, int nthreads, int mode, int alloc,
+	       mt_stats_t *stats)
+{
+    replay_t r;
+    worker_t *w;
+    int i, rep, nstreams;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double first, last;
+
+    r.nthreads = nthreads;
+    r.alloc = alloc;
+    r.failed = 0;
+    r.allocator = (alloc == MT_MM) ? &mm_locked : &libc;
+    if ((r.workers = calloc(nthreads, sizeof(worker_t))) == NULL)
+	mt_error("calloc failed in mt_replay");
+    pthread_barrier_init(&r.barrier, NULL, nthreads);
+
+    /* Hand out the requests */
+    nstreams = (mode == MT_PRODCONS) ? nthreads / 2 : nthreads;
+    for (i = 0; i < nthreads; i++) {
+	w = &r.workers[i];
+	w->id = i;
+	w->cpu = (ncpus > 0) ? i % ncpus : -1;
+	w->replay = &r;
+	w->role = ROLE_ALL;
+
+	if (mode == MT_COPY) {
+	    w->ops = trace->ops;
+	    w->num_ops = trace->num_ops;
+	}
+	else if (mode == MT_SPLIT) {
+	    w->ops = partition(trace, i, nstreams, &w->num_ops);
+	}
+	else if (i % 2 == 0) { /* producer of pair i/2 */
+	    w->role = ROLE_PRODUCER;
+	    w->ops = partition(trace, i / 2, nstreams, &w->num_ops);
+	    if (posix_memalign((void **)&w->queue, CACHE_LINE,
+			       sizeof(queue_t)) != 0)
+		mt_error("posix_memalign failed in mt_replay");
+	    w->queue->head = w->queue->tail = 0;
+	}
+	else {                 /* consumer of pair i/2 */
+	    w->role = ROLE_CONSUMER;
+	    w->queue = r.workers[i-1].queue;
+	}
+
+	if ((w->blocks = malloc(trace->num_ids * sizeof(char *))) == NULL ||
+	    (w->start = calloc(REPS, sizeof(double))) == NULL ||
+	    (w->end = calloc(REPS, sizeof(double))) == NULL)
+	    mt_error("malloc failed in mt_replay");
+    }
+
+    /* Count what each thread issues; frees go to the consumer */
+    for (i = 0; i < nthreads; i++) {
+	w = &r.workers[i];
+	if (w->role == ROLE_ALL) {
+	    w->issued = w->num_ops;
+	}
+	else if (w->role == ROLE_PRODUCER) {
+	    int j, frees = 0;
+	    for (j = 0; j < w->num_ops; j++)
+		frees += (w->ops[j].type == FREE);
+	    w->issued = w->num_ops - frees;
+	    r.workers[i+1].issued = frees;
+	}
+    }
+
+    for (i = 0; i < nthreads; i++)
+	if ((errno = pthread_create(&r.workers[i].tid, NULL,
+				    worker_thread, &r.workers[i])) != 0)
+	    mt_error("pthread_create failed in mt_replay");
+    for (i = 0; i < nthreads; i++)
+	pthread_join(r.workers[i].tid, NULL);
+
+    /* Keep the best time of each thread and of the run as a whole */
+    stats->nthreads = nthreads;
+    stats->ops = 0;
+    stats->secs = DBL_MAX;
+    stats->threads = NULL;
+    stats->failed = r.failed;
+    stats->fail_thread = r.fail_thread;
+    stats->fail_op = r.fail_op;
+    if (r.failed)
+	nthreads = 0;
+    else if ((stats->threads = calloc(nthreads, sizeof(mt_thread_t))) == NULL)
+	mt_error("calloc failed in mt_replay");
+    for (i = 0; i < nthreads; i++) {
+	stats->threads[i].cpu = r.workers[i].cpu;
+	stats->threads[i].ops = r.workers[i].issued;
+	stats->threads[i].secs = DBL_MAX;
+	stats->ops += r.workers[i].issued;
+    }
+    for (rep = 0; rep < REPS; rep++) {
+	first = DBL_MAX;
+	last = 0;
+	for (i = 0; i < nthreads; i++) {
+	    w = &r.workers[i];
+	    if (w->start[rep] < first)
+		first = w->start[rep];
+	    if (w->end[rep] > last)
+		last = w->end[rep];
+	    if (w->end[rep] - w->start[rep] < stats->threads[i].secs)
+		stats->threads[i].secs = w->end[rep] - w->start[rep];
+	}
+	if (last - first < stats->secs)
+	    stats->secs = last - first;
+    }
+
+    /* Clean up */
+    for (i = 0; i < r.nthreads; i++) {
+	w = &r.workers[i];
+	if (w->ops != trace->ops && w->role != ROLE_CONSUMER)
+	    free(w->ops);
+	if (w->role == ROLE_PRODUCER)
+	    free(w->queue);
+	free(w->blocks);
+	free(w->start);
+	free(w->end);
+    }
+    pthread_barrier_destroy(&r.barrier);
+    free(r.workers);
+}
+
+/*
+ * mt_printresults - Print the per-thread and aggregate results of the
+ *     replays of n traces. Traces that were not replayed (because they
+ *     failed the correctness check) have nthreads == 0, and those whose
+ *     replay failed have failed set.
+ */
+void mt_printresults(int n, mt_stats_t *stats)
+{
+    int i, j;
+    mt_thread_t *t;
+
+    printf("%5s%7s%5s%10s%10s%8s\n",
+	   "trace", "thread", "cpu", "ops", "secs", "Kops");
+    for (i = 0; i < n; i++) {
+	if (stats[i].failed && stats[i].fail_op < 0) {
+	    printf("%2d%8s  failed: mm_init returned -1\n", i, "-");
+	    continue;
+	}
+	if (stats[i].failed) {
+	    printf("%2d%8s  failed: thread %d got NULL on its request %d\n",
+		   i, "-", stats[i].fail_thread, stats[i].fail_op);
+	    continue;
+	}
+	if (stats[i].nthreads == 0) {
+	    printf("%2d%8s%5s%10s%10s%8s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	for (j = 0; j < stats[i].nthreads; j++) {
+	    t = &stats[i].threads[j];
+	    printf("%2d%8d%5d%10.0f%10.6f%8.0f\n",
+		   i, j, t->cpu, t->ops, t->secs,
+		   (t->ops/1e3)/t->secs);
+	}
+	printf("%2d%8s%5s%10.0f%10.6f%8.0f\n",
+	       i, "all", "-", stats[i].ops, stats[i].secs,
+	       (stats[i].ops/1e3)/stats[i].secs);
+    }
+}
+
+/*
+ * mt_freestats - Free the per-thread results of n replays
+ */
+void mt_freestats(int n, mt_stats_t *stats)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+	free(stats[i].threads);
+	stats[i].threads = NULL;
+    }
+}
+
+/*
+ * worker_thread - Body of a replay thread. Each rep starts with all
+ *     threads at a barrier, after which one of them resets the heap.
+ */
+static void *worker_thread(void *vargp)
+{
+    worker_t *w = (worker_t *)vargp;
+    replay_t *r = w->replay;
+    cpu_set_t set;
+    int rep;
+
+    if (w->cpu >= 0) {
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+	    w->cpu = -1;
+    }
+
+    for (rep = 0; rep < REPS; rep++) {
+	if (pthread_barrier_wait(&r->barrier) ==
+	    PTHREAD_BARRIER_SERIAL_THREAD && r->alloc == MT_MM) {
+	    mem_reset_brk();
+	    if (mm_engine->init() < 0)
+		fail(w, -1);
+	}
+	pthread_barrier_wait(&r->barrier);
+
+	/* A failure is seen by every thread here, so they all stop */
+	if (__atomic_load_n(&r->failed, __ATOMIC_ACQUIRE))
+	    break;
+
+	w->start[rep] = now();
+	if (w->role == ROLE_CONSUMER)
+	    run_consumer(w);
+	else
+	    run_ops(w);
+	w->end[rep] = now();
+    }
+    return NULL;
+}
+
+/*
+ * run_ops - Issue this thread's requests. A producer queues its frees
+ *     for the consumer instead of issuing them, then sends a NULL to
+ *     say it is done.
+ */
+static void run_ops(worker_t *w)
+{
+    allocator_t *a = w->replay->allocator;
+    traceop_t *op;
+    char *p;
+    int i, ok = 1;
+
+    for (i = 0; ok && i < w->num_ops; i++) {
+	op = &w->ops[i];
+	switch (op->type) {
+	case ALLOC:
+	    if ((p = a->malloc(op->size)) == NULL) {
+		fail(w, i);
+		ok = 0;
+	    }
+	    w->blocks[op->index] = p;
+	    break;
+
+	case REALLOC:
+	    if ((p = a->realloc(w->blocks[op->index], op->size)) == NULL) {
+		fail(w, i);
+		ok = 0;
+	    }
+	    w->blocks[op->index] = p;
+	    break;
+
+	case FREE:
+	    if (w->role == ROLE_PRODUCER)
+		queue_push(w->queue, w->blocks[op->index]);
+	    else
+		a->free(w->blocks[op->index]);
+	    break;
+	}
+    }
+
+    if (w->role == ROLE_PRODUCER)
+	queue_push(w->queue, NULL);
+}
+
+/*
+ * fail - Record that request op of this thread failed (-1 for mm_init),
+ *     unless another request failed first
+ */
+static void fail(worker_t *w, int op)
+{
+    replay_t *r = w->replay;
+    int expected = 0;
+
+    if (__atomic_compare_exchange_n(&r->failed, &expected, 1, 0,
+				    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+	r->fail_thread = w->id;
+	r->fail_op = op;
+    }
+}
+
+/*
+ * run_consumer - Free blocks handed over by the producer until it
+ *     sends NULL
+ */
+static void run_consumer(worker_t *w)
+{
+    allocator_t *a = w->replay->allocator;
+    char *p;
+
+    while ((p = queue_pop(w->queue)) != NULL)
+	a->free(p);
+}
+
+/*
+ * partition - Copy the requests of every block id with id % n == k.
+ *     All requests on one id stay together and in order, so each
+ *     part is a valid trace on its own.
+ */
+static traceop_t *partition(trace_t *trace, int k, int n, int *num_ops)
+{
+    traceop_t *ops;
+    int i, count = 0;
+
+    for (i = 0; i < trace->num_ops; i++)
+	count += (trace->ops[i].index % n == k);
+    if ((ops = malloc((count ? count : 1) * sizeof(traceop_t))) == NULL)
+	mt_error("malloc failed in partition");
+
+    count = 0;
+    for (i = 0; i < trace->num_ops; i++)
+	if (trace->ops[i].index % n == k)
+	    ops[count++] = trace->ops[i];
+    *num_ops = count;
+    return ops;
+}
+
+/*
+ * queue_push, queue_pop - Single-producer/single-consumer ring. Each
+ *     side writes only its own index and spins (yielding) when the
+ *     ring is full or empty.
+ */
+static void queue_push(queue_t *q, char *p)
+{
+    unsigned tail = q->tail;
+
+    while (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == QUEUE_SLOTS)
+	sched_yield();
+    q->slots[tail % QUEUE_SLOTS] = p;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static char *queue_pop(queue_t *q)
+{
+    unsigned head = q->head;
+    char *p;
+
+    while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == head)
+	sched_yield();
+    p = q->slots[head % QUEUE_SLOTS];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+/*
+ * The mm package serialized by a global lock
+ */
+static void *mm_malloc_locked(size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mm_lock);
+    p = mm_engine->malloc(size);
+    pthread_mutex_unlock(&mm_lock);
+    return p;
+}
+
+static void mm_free_locked(void *ptr)
+{
+    pthread_mutex_lock(&mm_lock);
+    mm_engine->free(ptr);
+    pthread_mutex_unlock(&mm_lock);
+}
+
+static void *mm_realloc_locked(void *ptr, size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mm_lock);
+    p = mm_engine->realloc(ptr, size);
+    pthread_mutex_unlock(&mm_lock);
+    return p;
+}
+
+/*
+ * now - Current time in seconds from the monotonic clock
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * mt_error - Report a fatal error during a threaded replay
+ */
+static void mt_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
@@ -0,0 +1,57 @@
+#ifndef __MTREPLAY_H_
+#define __MTREPLAY_H_
+
+/*
+ * mtreplay.h - Multi-threaded trace replay for measuring allocators
+ *     under contention
+ */
+#include "trace.h"
+
+/* How a trace is distributed over the replay threads */
+enum {
+    MT_SPLIT,     /* ops partitioned by block id, one stream per thread */
+    MT_COPY,      /* every thread replays an independent copy */
+    MT_PRODCONS   /* thread pairs: one allocates, the other frees */
+};
+
+/* Which allocator the threads call */
+enum {
+    MT_MM,        /* mm.c, serialized by a global lock */
+    MT_LIBC       /* libc malloc */
+};
+
+/* Per-thread results of a replay */
+typedef struct {
+    int cpu;         /* cpu the thread was pinned to */
+    double ops;      /* number of requests this thread issued */
+    double secs;     /* best running time of this thread */
+} mt_thread_t;
+
+/* Aggregate results of a replay */
+typedef struct {
+    int nthreads;
+    double ops;      /* total requests over all threads */
+    double secs;     /* best wall time from first start to last finish */
+    mt_thread_t *threads;
+    int failed;      /* a request failed, so there are no times... */
+    int fail_thread; /* ... and this thread ... */
+    int fail_op;     /* ... failed on its fail_op'th request */
+} mt_stats_t;
+
+/* Parse a mode name ("split", "copy", "prodcons"); -1 if unknown */
+int mt_parse_mode(char *name);
+
+/* Name of a replay mode */
+char *mt_mode_name(int mode);
+
+/* Replay trace on nthreads pinned threads and fill in stats */
+void mt_replay(trace_t *trace, int nthreads, int mode, int alloc,
+	       mt_stats_t *stats);
+
+/* Print per-thread and aggregate results for n traces */
+void mt_printresults(int n, mt_stats_t *stats);
+
+/* Free what mt_replay allocated in n stats */
+void mt_freestats(int n, mt_stats_t *stats);
+
+#endif /* __MTREPLAY_H_ */
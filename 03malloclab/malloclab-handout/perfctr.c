@@ -0,0 +1,238 @@
+/*
+ * perfctr.c - Count hardware events (instructions, cycles, cache, TLB
+ *     and branch misses) while a test function runs.
+ *
+ * Events are opened as perf_event_open groups, scheduled onto the PMU
+ * together and read back with one read() per group. Each event joins
+ * the current group if the group still gets scheduled with it (a short
+ * enabled probe shows time_running > 0); a PMU with fewer counters than
+ * events would otherwise never run the group at all. Otherwise it
+ * starts a new group, and the kernel multiplexes the groups. Only
+ * user-space events of the calling thread are counted, which works at
+ * the default perf_event_paranoid level. Events the cpu (or hypervisor)
+ * does not support, or that never run even alone, are dropped with a
+ * message and reported as unavailable. Counts of a group that had to be
+ * multiplexed are scaled by its time_enabled/time_running.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+/* Encodes a generic cache event for PERF_TYPE_HW_CACHE */
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+/* Loop iterations of the probe that checks a group gets scheduled */
+#define PROBE_SPINS 100000
+
+static struct {
+    char *name;
+    unsigned type;
+    unsigned long long config;
+} events[PERF_NEVENTS] = {
+    {"instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"L1D-miss", PERF_TYPE_HW_CACHE,
+     CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+		 PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {"LLC-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"dTLB-miss", PERF_TYPE_HW_CACHE,
+     CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+		 PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {"br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/* One counter group, read back together */
+typedef struct {
+    int leader;                   /* fd of the group leader */
+    int n;                        /* number of members... */
+    int order[PERF_NEVENTS];      /* ... and their events, in order */
+} group_t;
+
+static int fds[PERF_NEVENTS];     /* fd of each event, -1 if unavailable */
+static group_t groups[PERF_NEVENTS];
+static int ngroups = 0;
+
+/*
+ * open_event - Open one event as a member of the group led by leader,
+ *     or as the leader of a new group if leader is -1
+ */
+static int open_event(int event, int leader)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[event].type;
+    attr.config = events[event].config;
+    attr.disabled = (leader < 0);  /* the leader starts the whole group */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP |
+	PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+/*
+ * read_group - Read a group into buf (nr, time_enabled, time_running,
+ *     then one value per member); returns 0 on success, -1 on error
+ */
+static int read_group(group_t *g, unsigned long long *buf)
+{
+    ssize_t want = (3 + g->n) * sizeof(buf[0]);
+
+    if (read(g->leader, buf, want) != want ||
+	buf[0] != (unsigned long long)g->n)
+	return -1;
+    return 0;
+}
+
+/*
+ * probe - Enable group g alone around a short loop; does it get
+ *     scheduled onto the PMU?
+ */
+static int probe(group_t *g)
+{
+    unsigned long long buf[3 + PERF_NEVENTS];
+    volatile int spin;
+
+    ioctl(g->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    for (spin = 0; spin < PROBE_SPINS; spin++)
+	;
+    ioctl(g->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    return read_group(g, buf) == 0 && buf[2] > 0;
+}
+
+/*
+ * add_event - Put an event into the last group if that group still
+ *     runs with it, else into a new group of its own. Returns its
+ *     fd, or -1 with why set to the reason it was dropped.
+ */
+static int add_event(int event, char **why)
+{
+    group_t *g;
+    int fd;
+
+    if (ngroups > 0) {
+	g = &groups[ngroups - 1];
+	if ((fd = open_event(event, g->leader)) >= 0) {
+	    g->order[g->n++] = event;
+	    if (probe(g))
+		return fd;
+	    g->n--;
+	    close(fd);
+	}
+    }
+
+    if ((fd = open_event(event, -1)) < 0) {
+	*why = strerror(errno);
+	return -1;
+    }
+    g = &groups[ngroups];
+    g->leader = fd;
+    g->n = 1;
+    g->order[0] = event;
+    if (!probe(g)) {
+	close(fd);
+	*why = "never scheduled";
+	errno = EBUSY;
+	return -1;
+    }
+    ngroups++;
+    return fd;
+}
+
+/*
+ * perf_open - Open the counter groups and say which events were
+ *     dropped. Returns the number of events that can be counted; 0
+ *     means counters are unavailable (errno tells why the last attempt
+ *     failed).
+ */
+int perf_open(void)
+{
+    int i, count = 0;
+    char *why[PERF_NEVENTS];
+
+    for (i = 0; i < PERF_NEVENTS; i++)
+	if ((fds[i] = add_event(i, &why[i])) >= 0)
+	    count++;
+    if (count == 0)
+	return 0;
+
+    for (i = 0; i < PERF_NEVENTS; i++)
+	if (fds[i] < 0)
+	    printf("Hardware counters: %s dropped (%s)\n",
+		   events[i].name, why[i]);
+    if (ngroups > 1)
+	printf("Hardware counters: %d events in %d groups, counts are "
+	       "scaled for multiplexing\n", count, ngroups);
+    return count;
+}
+
+/*
+ * perf_close - Close every event of every group
+ */
+void perf_close(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_NEVENTS; i++)
+	if (fds[i] >= 0)
+	    close(fds[i]);
+    ngroups = 0;
+}
+
+/*
+ * perf_measure - Run f(argp) once with every counter group enabled and
+ *     record the event totals in stats
+ */
+void perf_measure(perf_test_funct f, void *argp, perf_stats_t *stats)
+{
+    /* nr, time_enabled, time_running, then one value per member */
+    unsigned long long buf[3 + PERF_NEVENTS];
+    double scale;
+    group_t *g;
+    int i, j;
+
+    memset(stats, 0, sizeof(perf_stats_t));
+    if (ngroups == 0)
+	return;
+
+    for (i = 0; i < ngroups; i++)
+	ioctl(groups[i].leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    for (i = 0; i < ngroups; i++)
+	ioctl(groups[i].leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    f(argp);
+    for (i = 0; i < ngroups; i++)
+	ioctl(groups[i].leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    /* A group that never ran this time (f was too short) counts nothing */
+    for (i = 0; i < ngroups; i++) {
+	g = &groups[i];
+	if (read_group(g, buf) < 0 || buf[2] == 0)
+	    continue;
+	scale = (buf[2] < buf[1]) ? (double)buf[1] / buf[2] : 1.0;
+	for (j = 0; j < g->n; j++) {
+	    stats->have[g->order[j]] = 1;
+	    stats->counts[g->order[j]] = buf[3 + j] * scale;
+	}
+	stats->valid = 1;
+    }
+}
+
+/*
+ * perf_event_name - Short column name of an event
+ */
+char *perf_event_name(int event)
+{
+    return events[event].name;
+}
@@ -0,0 +1,42 @@
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/*
+ * perfctr.h - Hardware performance counters around a test function,
+ *     using Linux perf_event_open counter groups
+ */
+
+/* The counted events, in the order they are reported */
+enum {
+    PERF_INSTRUCTIONS,
+    PERF_CYCLES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NEVENTS
+};
+
+/* The test function takes a generic pointer as input */
+typedef void (*perf_test_funct)(void *);
+
+/* Counter totals for one run of a test function */
+typedef struct {
+    int valid;                       /* was anything counted? */
+    int have[PERF_NEVENTS];          /* which events the cpu supports */
+    double counts[PERF_NEVENTS];     /* counts, scaled if multiplexed */
+} perf_stats_t;
+
+/* Open the counter groups; returns the number of usable events */
+int perf_open(void);
+
+/* Close the counter groups */
+void perf_close(void);
+
+/* Count events while running f(argp) once */
+void perf_measure(perf_test_funct f, void *argp, perf_stats_t *stats);
+
+/* Short column name of an event */
+char *perf_event_name(int event);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,63 @@
+/*
+ * rep2bin.c - Convert a text .rep trace into a binary trace (or back)
+ *
+ * Binary traces are loaded by mdriver with a single mmap instead of
+ * being parsed request by request, which makes traces with tens of
+ * millions of requests practical. See trace.h for the format. The
+ * requests are checked here rather than at load time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: rep2bin [-hr] <infile> <outfile>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-r         Write a .rep file instead of a binary trace.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int binary = 1;
+    trace_t *trace;
+
+    while ((c = getopt(argc, argv, "hr")) != EOF) {
+	switch (c) {
+	case 'r': /* Convert back to the text format */
+	    binary = 0;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+
+    /* Either format is accepted as input. A .rep trace was checked as
+       it was parsed, a binary one has to be checked here because
+       read_trace (and so mdriver) trusts it */
+    trace = read_trace("", argv[optind]);
+    if (trace->map != NULL)
+	check_trace(trace, argv[optind]);
+    if (write_trace(trace, argv[optind+1], binary) < 0) {
+	fprintf(stderr, "Could not write %s: %s\n",
+		argv[optind+1], strerror(errno));
+	exit(1);
+    }
+    free_trace(trace);
+
+    exit(0);
+}
@@ -0,0 +1,376 @@
+/*
+ * trace.c - Routines that read, write and free malloc lab trace files.
+ *
+ * Text traces (.rep) are parsed request by request with fscanf and
+ * checked with check_trace as they are read. Binary traces (see trace.h)
+ * are mapped read-only with mmap and their packed request array is used
+ * directly as trace->ops, so no per-request work is done at load time;
+ * they are trusted, having been checked when rep2bin wrote them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE     1024 /* max string size */
+
+/* Function prototypes */
+static void read_rep(trace_t *trace, FILE *tracefile, char *path);
+static void map_bin(trace_t *trace, int fd, char *path);
+static void alloc_blocks(trace_t *trace);
+static void trace_error(char *msg, char *path, int err);
+
+/*
+ * read_trace - read a trace file and store it in memory
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char path[MAXLINE];
+    char magic[sizeof(TRACE_MAGIC)];
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
+	trace_error("malloc failed in read_trace", NULL, errno);
+
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL)
+	trace_error("Could not open tracefile", path, errno);
+
+    /* Binary traces are recognized by their magic string */
+    if (fread(magic, 1, sizeof(magic), tracefile) == sizeof(magic) &&
+	memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+	map_bin(trace, fileno(tracefile), path);
+    }
+    else {
+	rewind(tracefile);
+	read_rep(trace, tracefile, path);
+    }
+    fclose(tracefile);
+
+    alloc_blocks(trace);
+    return trace;
+}
+
+/*
+ * free_trace - Free the trace record and the arrays it points to,
+ *              all of which were allocated (or mapped) in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+    if (trace->map != NULL)   /* unmap or free the request array... */
+	munmap(trace->map, trace->map_len);
+    else
+	free(trace->ops);
+    free(trace->src);         /* ... the origins of a mix's requests... */
+    free(trace->blocks);      /* ... the two block arrays... */
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*
+ * write_trace - Write trace to path, either as a text .rep file or, if
+ *     binary is set, as a binary trace that read_trace can map directly.
+ *     Returns 0 on success and -1 (with errno set) on error.
+ */
+int write_trace(trace_t *trace, char *path, int binary)
+{
+    FILE *fp;
+    tracehdr_t hdr;
+    traceop_t *op;
+    int i;
+
+    if ((fp = fopen(path, binary ? "wb" : "w")) == NULL)
+	return -1;
+
+    if (binary) {
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	hdr.version = TRACE_VERSION;
+	hdr.op_size = sizeof(traceop_t);
+	hdr.sugg_heapsize = trace->sugg_heapsize;
+	hdr.num_ids = trace->num_ids;
+	hdr.num_ops = trace->num_ops;
+	hdr.weight = trace->weight;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, fp) !=
+	    (size_t)trace->num_ops) {
+	    fclose(fp);
+	    return -1;
+	}
+    }
+    else {
+	fprintf(fp, "%d\n%d\n%d\n%d\n", trace->sugg_heapsize,
+		trace->num_ids, trace->num_ops, trace->weight);
+	for (i = 0; i < trace->num_ops; i++) {
+	    op = &trace->ops[i];
+	    switch (op->type) {
+	    case ALLOC:
+		fprintf(fp, "a %d %d\n", op->index, op->size);
+		break;
+	    case REALLOC:
+		fprintf(fp, "r %d %d\n", op->index, op->size);
+		break;
+	    case FREE:
+		fprintf(fp, "f %d\n", op->index);
+		break;
+	    }
+	}
+    }
+
+    return fclose(fp);
+}
+
+/*
+ * read_rep - Parse a text .rep trace into a malloc'd request array
+ */
+static void read_rep(trace_t *trace, FILE *tracefile, char *path)
+{
+    char type[MAXLINE];
+    unsigned index, size;
+    unsigned max_index = 0;
+    unsigned op_index;
+
+    /* Read the trace file header */
+    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+    fscanf(tracefile, "%d", &(trace->num_ids));
+    fscanf(tracefile, "%d", &(trace->num_ops));
+    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops =
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	trace_error("malloc failed in read_rep", path, errno);
+
+    /* read every request line in the trace file */
+    index = 0;
+    op_index = 0;
+    while (fscanf(tracefile, "%s", type) != EOF) {
+	switch(type[0]) {
+	case 'a':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'r':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = REALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'f':
+	    fscanf(tracefile, "%ud", &index);
+	    trace->ops[op_index].type = FREE;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = 0;
+	    break;
+	default:
+	    printf("Bogus type character (%c) in tracefile %s\n",
+		   type[0], path);
+	    exit(1);
+	}
+	op_index++;
+
+    }
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+    check_trace(trace, path);
+}
+
+/*
+ * map_bin - Map a binary trace read-only and point trace->ops at its
+ *     packed request array. Only the header is checked here; the
+ *     requests themselves are not touched until the replay reads them.
+ */
+static void map_bin(trace_t *trace, int fd, char *path)
+{
+    struct stat st;
+    tracehdr_t *hdr;
+
+    if (fstat(fd, &st) < 0)
+	trace_error("fstat failed in map_bin", path, errno);
+    if ((size_t)st.st_size < sizeof(tracehdr_t))
+	trace_error("Truncated binary trace header", path, 0);
+
+    trace->map_len = st.st_size;
+    trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+	trace_error("mmap failed in map_bin", path, errno);
+    hdr = (tracehdr_t *)trace->map;
+
+    if (hdr->version != TRACE_VERSION || hdr->op_size != sizeof(traceop_t))
+	trace_error("Unsupported binary trace version or layout", path, 0);
+    if (hdr->num_ops < 0 || hdr->num_ids < 0 ||
+	trace->map_len < sizeof(tracehdr_t) +
+	(size_t)hdr->num_ops * sizeof(traceop_t))
+	trace_error("Truncated binary trace", path, 0);
+
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+
+    /* Requests are replayed front to back */
+    madvise(trace->map, trace->map_len, MADV_SEQUENTIAL);
+}
+
+/*
+ * mix_traces - Interleave several traces into one. Trace i feeds a
+ *     stream of its requests repeated rounds times; the ids of replay
+ *     r of trace i are offset past those of every earlier trace and
+ *     replay, so no two streams ever share a block. Streams of
+ *     different lengths wrap around at different times, so the blocks
+ *     of one replay are freed while other traces are in mid-flight,
+ *     which is where fragmentation builds up. In MIX_RANDOM order each
+ *     request comes from a stream chosen with probability proportional
+ *     to the requests it has left, so all streams end together; that
+ *     count is the only weight, a trace's own weight field is ignored.
+ */
+trace_t *mix_traces(trace_t **traces, int n, int rounds, int mode,
+		    unsigned seed)
+{
+    trace_t *mix;
+    long long *next, *base, total = 0, left, pick;
+    long long ids = 0;
+    int i, k;
+    traceop_t *op;
+
+    if ((mix = (trace_t *)calloc(1, sizeof(trace_t))) == NULL ||
+	(next = (long long *)calloc(n, sizeof(long long))) == NULL ||
+	(base = (long long *)calloc(n, sizeof(long long))) == NULL)
+	trace_error("malloc failed in mix_traces", NULL, errno);
+
+    /* Stream i takes ids [base[i], base[i] + rounds*num_ids) */
+    for (i = 0; i < n; i++) {
+	base[i] = ids;
+	ids += (long long)rounds * traces[i]->num_ids;
+	total += (long long)rounds * traces[i]->num_ops;
+    }
+    if (ids > INT_MAX || total > INT_MAX)
+	trace_error("Too many requests in mix_traces", NULL, 0);
+    mix->num_ids = ids;
+    mix->num_ops = total;
+    mix->weight = 1;
+    if ((mix->ops = (traceop_t *)malloc(total * sizeof(traceop_t))) == NULL ||
+	(mix->src = (mixsrc_t *)malloc(total * sizeof(mixsrc_t))) == NULL)
+	trace_error("malloc failed in mix_traces", NULL, errno);
+
+    for (k = 0, left = total, i = n - 1; k < total; k++, left--) {
+	/* Choose the stream that issues request k */
+	if (mode == MIX_RR) {
+	    do
+		i = (i + 1) % n;
+	    while (next[i] == (long long)rounds * traces[i]->num_ops);
+	}
+	else {
+	    pick = ((long long)rand_r(&seed) * (RAND_MAX + 1LL) +
+		    rand_r(&seed)) % left;
+	    for (i = 0; i < n; i++) {
+		pick -= (long long)rounds * traces[i]->num_ops - next[i];
+		if (pick < 0)
+		    break;
+	    }
+	}
+
+	/* Copy its next request, moving the id into this replay's range,
+	   and remember where it came from for error messages */
+	op = &traces[i]->ops[next[i] % traces[i]->num_ops];
+	mix->ops[k] = *op;
+	mix->ops[k].index = base[i] +
+	    (next[i] / traces[i]->num_ops) * traces[i]->num_ids + op->index;
+	mix->src[k].trace = i;
+	mix->src[k].op = next[i] % traces[i]->num_ops;
+	mix->src[k].round = next[i] / traces[i]->num_ops;
+	next[i]++;
+    }
+
+    free(next);
+    free(base);
+    alloc_blocks(mix);
+    return mix;
+}
+
+/*
+ * alloc_blocks - Allocate the per-id block pointer and size arrays
+ */
+static void alloc_blocks(trace_t *trace)
+{
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks =
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	trace_error("malloc failed in alloc_blocks", NULL, errno);
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	trace_error("malloc failed in alloc_blocks", NULL, errno);
+}
+
+/*
+ * check_trace - Make sure the trace can be replayed safely: every
+ *     request has a known type and an id below num_ids, sizes are
+ *     positive (the replay asserts as much), and each id is only
+ *     freed or realloc'd while it is allocated and only allocated
+ *     while it is not. One pass, keeping a live flag per id.
+ */
+void check_trace(trace_t *trace, char *name)
+{
+    traceop_t *op;
+    char *live, *why;
+    int i;
+
+    if ((live = (char *)calloc(trace->num_ids + 1, 1)) == NULL)
+	trace_error("malloc failed in check_trace", name, errno);
+
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	why = NULL;
+	if ((op->type != ALLOC && op->type != FREE && op->type != REALLOC) ||
+	    op->index < 0 || op->index >= trace->num_ids)
+	    why = "unknown type or id";
+	else if (op->type != FREE && op->size <= 0)
+	    why = "size is not positive";
+	else if (op->type == ALLOC && live[op->index])
+	    why = "id is already allocated";
+	else if (op->type != ALLOC && !live[op->index])
+	    why = "id is not allocated";
+	if (why != NULL) {
+	    fprintf(stderr, "Bad request %d in trace %s: %s (type %d, id %d, "
+		    "size %d; trace has %d ids)\n", i, name, why, op->type,
+		    op->index, op->size, trace->num_ids);
+	    exit(1);
+	}
+	live[op->index] = (op->type != FREE);
+    }
+    free(live);
+}
+
+/*
+ * trace_error - Report a fatal error while handling a trace file,
+ *     with the reason in err when a system call failed (else 0)
+ */
+static void trace_error(char *msg, char *path, int err)
+{
+    if (path != NULL)
+	fprintf(stderr, "%s (%s)", msg, path);
+    else
+	fprintf(stderr, "%s", msg);
+    if (err != 0)
+	fprintf(stderr, ": %s", strerror(err));
+    fprintf(stderr, "\n");
+    exit(1);
+}
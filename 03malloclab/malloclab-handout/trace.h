@@ -0,0 +1,98 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - In-memory and on-disk representation of malloc lab traces
+ *
+ * A trace is either a text .rep file (four header lines followed by one
+ * "a|r|f" request per line) or a binary trace: a fixed tracehdr_t
+ * followed immediately by num_ops packed traceop_t records. Binary
+ * traces are mmap'd and used in place, so loading them costs O(1)
+ * regardless of the number of requests. That also means their requests
+ * are trusted: a .rep trace is checked as it is parsed, and rep2bin
+ * checks whatever it converts, so only binary traces it (or a recorder
+ * that builds them correctly) wrote should be replayed.
+ */
+#include <stddef.h>
+
+/* Request types */
+enum {ALLOC, FREE, REALLOC};
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    int type;                         /* ALLOC, FREE or REALLOC */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mmap'd binary trace backing ops (or NULL) */
+    size_t map_len;      /* length of that mapping */
+    struct mixsrc *src;  /* where each request of a mix came from (or NULL) */
+} trace_t;
+
+/* The origin of one request of a trace built by mix_traces */
+typedef struct mixsrc {
+    int trace;           /* index of its trace among those mixed */
+    int op;              /* its index among that trace's requests */
+    int round;           /* which replay of that trace, from 0 */
+} mixsrc_t;
+
+/*
+ * Header of a binary trace file. All fields are stored in host byte
+ * order; op_size guards against reading a trace written by a build
+ * with a different traceop_t layout.
+ */
+#define TRACE_MAGIC     "MMTRACE"  /* 7 chars + NUL fill magic[8] */
+#define TRACE_VERSION   1
+
+typedef struct {
+    char magic[8];       /* TRACE_MAGIC */
+    int version;         /* TRACE_VERSION */
+    int op_size;         /* sizeof(traceop_t) */
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+} tracehdr_t;
+
+/* Read a .rep or binary trace at tracedir/filename (format is detected) */
+trace_t *read_trace(char *tracedir, char *filename);
+
+/*
+ * Exit with an error unless the trace replays safely: valid types and
+ * ids, positive sizes, and no id freed or realloc'd while not allocated
+ */
+void check_trace(trace_t *trace, char *name);
+
+/* Free a trace returned by read_trace */
+void free_trace(trace_t *trace);
+
+/* Write a trace to path as a .rep file (binary == 0) or binary trace */
+int write_trace(trace_t *trace, char *path, int binary);
+
+/* How mix_traces interleaves the requests of its traces */
+enum {
+    MIX_RR,       /* one request from each trace in turn */
+    MIX_RANDOM    /* the next trace drawn at random, weighted by the
+		     number of requests it has left to issue */
+};
+
+/*
+ * Interleave n traces, each replayed rounds times back to back, into
+ * one trace on a single heap; every replay gets its own block ids.
+ * The result's src records where each request came from, and it is
+ * freed with free_trace.
+ */
+trace_t *mix_traces(trace_t **traces, int n, int rounds, int mode,
+		    unsigned seed);
+
+#endif /* __TRACE_H_ */
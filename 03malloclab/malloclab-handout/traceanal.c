@@ -0,0 +1,336 @@
+/*
+ * traceanal.c - Describe the workload in malloc lab traces
+ *
+ * For each trace (text .rep or binary) prints the request size
+ * histogram, block lifetimes measured in requests, peak and average
+ * live payload, the lengths of realloc chains, and how the blocks
+ * would spread over the size classes of mm.c's segregated lists.
+ *
+ * It also bounds the heap from below. mdriver scores utilization as
+ * peak live payload over final heap size, and no allocator can do
+ * better than holding, at the busiest moment, every live block in the
+ * smallest form its block format allows. Three such floors are
+ * reported: the raw payload (any allocator), the payload rounded to
+ * the 8-byte alignment (any allocator without headers), and mm.c's
+ * blocks with their boundary tags plus its fixed prologue. The gap
+ * between the last of these and mdriver's utilization is all the
+ * headroom the trace has for a better placement policy.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "trace.h"
+
+/* The block format and size classes of mm.c */
+#define WSIZE        4
+#define DSIZE        8
+#define SEGSIZE     50
+#define ASIZE(size)  ((size) <= DSIZE ? 2*DSIZE : \
+		      ((size) + DSIZE + (DSIZE-1)) / DSIZE * DSIZE)
+#define ALIGN(size)  (((size) + (DSIZE-1)) / DSIZE * DSIZE)
+#define MM_FIXED     (SEGSIZE*WSIZE + 4*WSIZE) /* list heads, prologue */
+
+/* Power of two histograms: bucket b > 0 counts [2^(b-1), 2^b) */
+#define NBUCKETS    33
+
+/* Per-class statistics of the segregated lists */
+typedef struct {
+    long requests;       /* allocs and reallocs landing in the class */
+    long live;           /* blocks in the class now... */
+    long peak;           /* ... and at most */
+    long long bytes;     /* block bytes in the class now... */
+    long long peak_bytes;/* ... and at most */
+} segclass_t;
+
+/* What is known about one block id */
+typedef struct {
+    int born;            /* request that allocated it */
+    int size;            /* current payload size */
+    int reallocs;        /* reallocs so far */
+    int live;            /* allocated and not yet freed? */
+} idinfo_t;
+
+static int summary = 0;  /* one line per trace only (-s) */
+
+/*
+ * bucket - Power of two histogram bucket of a non-negative value
+ */
+static int bucket(long long v)
+{
+    int b = 0;
+
+    while (v > 0 && b < NBUCKETS - 1) {
+	v >>= 1;
+	b++;
+    }
+    return b;
+}
+
+/*
+ * seg_class - The segregated list mm.c files a block of asize bytes in
+ *     (CEIL_POW2_IDX, capped at the last list)
+ */
+static int seg_class(size_t asize)
+{
+    int idx = 0;
+
+    if (asize <= 1)
+	return 0;
+    asize = (asize - 1) >> 1;
+    while (asize != 0) {
+	asize >>= 1;
+	idx++;
+    }
+    return (idx + 1 < SEGSIZE) ? idx + 1 : SEGSIZE - 1;
+}
+
+/*
+ * cmp_int - qsort comparison of ints
+ */
+static int cmp_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * printhist - Print a power of two histogram, skipping empty buckets
+ */
+static void printhist(char *title, char *unit, long *count)
+{
+    long total = 0;
+    int b;
+
+    for (b = 0; b < NBUCKETS; b++)
+	total += count[b];
+    printf("%s\n", title);
+    if (total == 0) {
+	printf("    (none)\n");
+	return;
+    }
+    for (b = 0; b < NBUCKETS; b++) {
+	if (count[b] == 0)
+	    continue;
+	if (b == 0)
+	    printf("%26s %-6s", "0", unit);
+	else
+	    printf("%12lld - %11lld %-6s", 1LL << (b-1), (1LL << b) - 1, unit);
+	printf("%10ld %6.1f%%\n", count[b], 100.0 * count[b] / total);
+    }
+}
+
+/*
+ * analyze - Replay the trace on paper and report on it
+ */
+static void analyze(char *name, trace_t *trace)
+{
+    idinfo_t *ids;
+    int *lifetimes, nlifetimes = 0;
+    long sizes[NBUCKETS], lives[NBUCKETS], chains[NBUCKETS];
+    long nalloc = 0, nrealloc = 0, nfree = 0, leaked = 0;
+    long long payload = 0, aligned = 0, blocks = 0;
+    long long peak_payload = 0, peak_aligned = 0, peak_blocks = 0;
+    long long chain_total = 0;
+    int chain_max = 0, chain_ids = 0;
+    double live_sum = 0;
+    segclass_t seg[SEGSIZE];
+    traceop_t *op;
+    idinfo_t *id;
+    int i, c;
+
+    if ((ids = (idinfo_t *)calloc(trace->num_ids, sizeof(idinfo_t))) == NULL ||
+	(lifetimes = (int *)malloc(trace->num_ids * sizeof(int))) == NULL) {
+	fprintf(stderr, "Out of memory analyzing %s\n", name);
+	exit(1);
+    }
+    memset(sizes, 0, sizeof(sizes));
+    memset(lives, 0, sizeof(lives));
+    memset(chains, 0, sizeof(chains));
+    memset(seg, 0, sizeof(seg));
+
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	id = &ids[op->index];
+
+	/* Take the block's old form out of the running totals */
+	if (op->type != ALLOC && id->live) {
+	    payload -= id->size;
+	    aligned -= ALIGN(id->size);
+	    blocks -= ASIZE(id->size);
+	    c = seg_class(ASIZE(id->size));
+	    seg[c].live--;
+	    seg[c].bytes -= ASIZE(id->size);
+	}
+
+	switch (op->type) {
+	case ALLOC:
+	    nalloc++;
+	    id->born = i;
+	    id->reallocs = 0;
+	    id->live = 1;
+	    break;
+	case REALLOC:
+	    nrealloc++;
+	    id->reallocs++;
+	    break;
+	case FREE:
+	    nfree++;
+	    if (id->live) {
+		lifetimes[nlifetimes++] = i - id->born;
+		lives[bucket(i - id->born)]++;
+		chains[bucket(id->reallocs)]++;
+	    }
+	    id->live = 0;
+	    break;
+	}
+
+	/* And put its new form back in */
+	if (op->type != FREE) {
+	    id->size = op->size;
+	    sizes[bucket(op->size)]++;
+	    payload += op->size;
+	    aligned += ALIGN(op->size);
+	    blocks += ASIZE(op->size);
+	    c = seg_class(ASIZE(op->size));
+	    seg[c].requests++;
+	    seg[c].bytes += ASIZE(op->size);
+	    if (++seg[c].live > seg[c].peak)
+		seg[c].peak = seg[c].live;
+	    if (seg[c].bytes > seg[c].peak_bytes)
+		seg[c].peak_bytes = seg[c].bytes;
+	}
+	if (payload > peak_payload)
+	    peak_payload = payload;
+	if (aligned > peak_aligned)
+	    peak_aligned = aligned;
+	if (blocks > peak_blocks)
+	    peak_blocks = blocks;
+	live_sum += payload;
+    }
+
+    /* Blocks never freed still count as realloc chains */
+    for (i = 0; i < trace->num_ids; i++) {
+	if (ids[i].live) {
+	    leaked++;
+	    chains[bucket(ids[i].reallocs)]++;
+	}
+    }
+    for (i = 0; i < trace->num_ids; i++) {
+	if (ids[i].reallocs > 0) {
+	    chain_ids++;
+	    chain_total += ids[i].reallocs;
+	    if (ids[i].reallocs > chain_max)
+		chain_max = ids[i].reallocs;
+	}
+    }
+    qsort(lifetimes, nlifetimes, sizeof(int), cmp_int);
+
+    if (summary) {
+	printf("%-24s%10d%9d%12lld%12.0f%9.1f%%\n", name,
+	       trace->num_ops, trace->num_ids, peak_payload,
+	       trace->num_ops ? live_sum / trace->num_ops : 0.0,
+	       peak_payload ? 100.0 * peak_payload / (peak_blocks + MM_FIXED)
+	       : 0.0);
+	free(ids);
+	free(lifetimes);
+	return;
+    }
+
+    printf("%s: %d requests (%ld alloc, %ld realloc, %ld free), %d ids\n",
+	   name, trace->num_ops, nalloc, nrealloc, nfree, trace->num_ids);
+    if (leaked)
+	printf("  %ld blocks are never freed\n", leaked);
+
+    printf("\n");
+    printhist("Request sizes (allocs and reallocs):", "bytes", sizes);
+
+    printf("\n");
+    printhist("Lifetimes of freed blocks:", "reqs", lives);
+    if (nlifetimes > 0)
+	printf("  median %d, p90 %d, max %d requests\n",
+	       lifetimes[nlifetimes / 2], lifetimes[nlifetimes * 9 / 10],
+	       lifetimes[nlifetimes - 1]);
+
+    printf("\n");
+    printhist("Reallocs per block:", "", chains);
+    if (chain_ids > 0)
+	printf("  %d blocks are realloc'd, %.1f times on average, at most %d\n",
+	       chain_ids, (double)chain_total / chain_ids, chain_max);
+
+    printf("\nLive payload: peak %lld bytes, average %.0f bytes\n",
+	   peak_payload, trace->num_ops ? live_sum / trace->num_ops : 0.0);
+
+    printf("\nmm.c size classes (SEGSIZE %d):\n", SEGSIZE);
+    printf("%7s%24s%11s%11s%14s\n",
+	   "class", "block bytes", "requests", "peak live", "peak bytes");
+    for (c = 0; c < SEGSIZE; c++) {
+	if (seg[c].requests == 0)
+	    continue;
+	if (c == SEGSIZE - 1)
+	    printf("%7d%11lld - %10s", c, (1LL << (c-1)) + 1, "");
+	else
+	    printf("%7d%11lld - %10lld", c, c ? (1LL << (c-1)) + 1 : 0,
+		   1LL << c);
+	printf("%11ld%11ld%14lld\n",
+	       seg[c].requests, seg[c].peak, seg[c].peak_bytes);
+    }
+
+    printf("\nSmallest possible heap at the peak:\n");
+    printf("  %-34s%12lld bytes  util <= %5.1f%%\n", "payload only",
+	   peak_payload, peak_payload ? 100.0 : 0.0);
+    printf("  %-34s%12lld bytes  util <= %5.1f%%\n", "8-byte aligned payload",
+	   peak_aligned,
+	   peak_aligned ? 100.0 * peak_payload / peak_aligned : 0.0);
+    printf("  %-34s%12lld bytes  util <= %5.1f%%\n",
+	   "mm.c blocks and prologue", peak_blocks + MM_FIXED,
+	   100.0 * peak_payload / (peak_blocks + MM_FIXED));
+    printf("\n");
+
+    free(ids);
+    free(lifetimes);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: traceanal [-hs] <trace>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-s         Print one summary line per trace.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, i;
+    trace_t *trace;
+
+    while ((c = getopt(argc, argv, "hs")) != EOF) {
+	switch (c) {
+	case 's': /* Summary table only */
+	    summary = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind == argc) {
+	usage();
+	exit(1);
+    }
+
+    if (summary)
+	printf("%-24s%10s%9s%12s%12s%10s\n", "trace", "requests", "ids",
+	       "peak live", "avg live", "max util");
+    for (i = optind; i < argc; i++) {
+	/* Either format is accepted */
+	trace = read_trace("", argv[i]);
+	analyze(argv[i], trace);
+	free_trace(trace);
+    }
+
+    exit(0);
+}
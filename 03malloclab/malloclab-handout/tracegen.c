@@ -0,0 +1,493 @@
+/*
+ * tracegen.c - Generate synthetic malloc lab traces
+ *
+ * A trace is generated as a sequence of phases. Each phase runs for a
+ * given number of requests and has its own request size mixture,
+ * block lifetime distribution and realloc behavior; blocks allocated
+ * in one phase live on into the next. Time is counted in requests.
+ *
+ * Every live block has exactly one pending event (its next realloc or
+ * its free) in a min-heap ordered by time. At each step the earliest
+ * event is issued if it is due; otherwise a new block is allocated,
+ * unless that would take the live payload past the peak target, in
+ * which case the earliest event is issued early instead. Once all
+ * phases are done, the remaining blocks are freed so that the trace
+ * is balanced. The same seed always gives the same trace.
+ *
+ * Options that describe a phase (-s, -l, -g) apply to the phase begun
+ * by the most recent -n; a new phase starts out as a copy of the one
+ * before it. For example
+ *
+ *   tracegen -m 16M -n 5000000 -s 8-64:70,64-1024:29,4096-65536:1 \
+ *            -l exp:2000 -n 5000000 -l pareto:1.2:50 -g 0.01:2:8 \
+ *            -o big.bin -b
+ *
+ * writes a 10M+ request binary trace whose second half has heavy
+ * tailed lifetimes and occasional chains of eight doubling reallocs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "trace.h"
+
+/* Limits */
+#define MAXPHASES  64        /* most phases in one trace */
+#define MAXCLASSES 32        /* most size classes in one mixture */
+#define MAXSIZE    (1<<30)   /* largest block a realloc chain may reach */
+
+/* Lifetime distributions */
+enum {LIFE_EXP, LIFE_PARETO};
+
+/* One component of a size mixture: uniform in [lo, hi] */
+typedef struct {
+    int lo, hi;
+    double weight;
+} sizeclass_t;
+
+/* Describes one phase of the trace */
+typedef struct {
+    long long ops;                   /* requests issued in this phase */
+    int nclasses;
+    sizeclass_t classes[MAXCLASSES]; /* request size mixture */
+    double total_weight;
+    int life;                        /* LIFE_EXP or LIFE_PARETO */
+    double life_a, life_b;           /* exp: mean; pareto: alpha, min */
+    double chain_prob;               /* chance a block is a realloc chain */
+    double chain_factor;             /* growth of each realloc */
+    int chain_len;                   /* reallocs in a chain */
+} phase_t;
+
+/* State of a block that has been allocated and not yet freed */
+typedef struct {
+    int size;                        /* current payload size */
+    int reallocs_left;               /* reallocs still to come */
+    double factor;                   /* growth of each of them */
+    long long death;                 /* when the block is freed */
+} block_t;
+
+/* A pending event; the block's state says whether it is a free */
+typedef struct {
+    long long time;
+    int id;
+} event_t;
+
+/* Global state of the generator */
+static unsigned long long rng_state;
+static event_t *heap;                /* min-heap of pending events */
+static int heap_len, heap_cap;
+static block_t *blocks;              /* indexed by block id */
+static int num_ids, blocks_cap;
+static traceop_t *ops;               /* the generated requests */
+static int num_ops, ops_cap;
+static long long live, peak;         /* live payload bytes and its max */
+
+/* Function prototypes */
+static void generate(phase_t *phases, int nphases, long long target);
+static void issue_event(long long now);
+static void emit(int type, int index, int size);
+static void heap_push(long long time, int id);
+static event_t heap_pop(void);
+static int sample_size(phase_t *ph);
+static long long sample_life(phase_t *ph);
+static double uniform(void);
+static void parse_sizes(phase_t *ph, char *spec);
+static void parse_life(phase_t *ph, char *spec);
+static void parse_chain(phase_t *ph, char *spec);
+static long long parse_bytes(char *s);
+static void *grow(void *p, int *cap, int need, size_t elsize);
+static void usage(void);
+static void gen_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    phase_t phases[MAXPHASES];
+    phase_t *cur;
+    int nphases = 0;
+    int c, binary = 0;
+    long long target = 0;
+    unsigned long long seed = 1;
+    char *outfile = NULL;
+    trace_t trace;
+
+    /* The defaults, used as the template of the first phase */
+    cur = &phases[0];
+    memset(cur, 0, sizeof(phase_t));
+    cur->ops = 100000;
+    parse_sizes(cur, "8-512:1");
+    parse_life(cur, "exp:1000");
+
+    while ((c = getopt(argc, argv, "n:s:l:g:m:S:o:bh")) != EOF) {
+	switch (c) {
+	case 'n': /* Start a new phase of this many requests */
+	    if (nphases == MAXPHASES)
+		gen_error("Too many phases");
+	    if (nphases > 0)
+		phases[nphases] = phases[nphases-1];
+	    cur = &phases[nphases++];
+	    if ((cur->ops = atoll(optarg)) <= 0)
+		gen_error("Phase length must be positive");
+	    break;
+	case 's': /* Size mixture of the current phase */
+	    parse_sizes(cur, optarg);
+	    break;
+	case 'l': /* Lifetime distribution of the current phase */
+	    parse_life(cur, optarg);
+	    break;
+	case 'g': /* Realloc growth chains in the current phase */
+	    parse_chain(cur, optarg);
+	    break;
+	case 'm': /* Target peak live payload */
+	    target = parse_bytes(optarg);
+	    break;
+	case 'S': /* Random seed */
+	    seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'o': /* Output file */
+	    outfile = optarg;
+	    break;
+	case 'b': /* Write a binary trace */
+	    binary = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (outfile == NULL) {
+	usage();
+	exit(1);
+    }
+    if (nphases == 0)
+	nphases = 1;
+
+    rng_state = seed;
+    generate(phases, nphases, target);
+
+    trace.sugg_heapsize = (peak > 0x7fffffff) ? 0x7fffffff : (int)peak;
+    trace.num_ids = num_ids;
+    trace.num_ops = num_ops;
+    trace.weight = 1;
+    trace.ops = ops;
+    if (write_trace(&trace, outfile, binary) < 0) {
+	fprintf(stderr, "Could not write %s: %s\n", outfile, strerror(errno));
+	exit(1);
+    }
+    printf("%s: %d requests, %d blocks, peak live %lld bytes\n",
+	   outfile, num_ops, num_ids, peak);
+    exit(0);
+}
+
+/*
+ * generate - Run every phase, then free whatever is still live
+ */
+static void generate(phase_t *phases, int nphases, long long target)
+{
+    long long now = 0, end = 0;
+    phase_t *ph;
+    block_t *b;
+    int i, size;
+
+    for (i = 0; i < nphases; i++) {
+	ph = &phases[i];
+	end += ph->ops;
+	while (now < end) {
+	    if (heap_len > 0 && heap[0].time <= now) {
+		issue_event(now);
+	    }
+	    else {
+		size = sample_size(ph);
+		if (target > 0 && live + size > target && heap_len > 0) {
+		    issue_event(now);    /* make room first */
+		}
+		else {
+		    blocks = grow(blocks, &blocks_cap, num_ids + 1,
+				  sizeof(block_t));
+		    b = &blocks[num_ids];
+		    b->size = size;
+		    b->death = now + sample_life(ph);
+		    b->reallocs_left = 0;
+		    b->factor = ph->chain_factor;
+		    if (ph->chain_prob > 0 && uniform() < ph->chain_prob)
+			b->reallocs_left = ph->chain_len;
+		    emit(ALLOC, num_ids, size);
+		    live += size;
+		    if (live > peak)
+			peak = live;
+
+		    /* The first realloc, if any, comes before the free */
+		    heap_push(b->reallocs_left ?
+			      now + (b->death - now) / (b->reallocs_left + 1) :
+			      b->death, num_ids);
+		    num_ids++;
+		}
+	    }
+	    now++;
+	}
+    }
+
+    /* Balance the trace */
+    while (heap_len > 0) {
+	b = &blocks[heap[0].id];
+	b->reallocs_left = 0;
+	issue_event(now++);
+    }
+}
+
+/*
+ * issue_event - Issue the earliest pending event: either the next
+ *     realloc of a chain (then schedule the one after it) or a free
+ */
+static void issue_event(long long now)
+{
+    event_t ev = heap_pop();
+    block_t *b = &blocks[ev.id];
+    double newsize;
+
+    if (b->reallocs_left > 0) {
+	newsize = b->size * b->factor;
+	if (newsize > MAXSIZE)
+	    newsize = MAXSIZE;
+	if (newsize < 1)
+	    newsize = 1;
+	live += (int)newsize - b->size;
+	if (live > peak)
+	    peak = live;
+	b->size = (int)newsize;
+	emit(REALLOC, ev.id, b->size);
+
+	b->reallocs_left--;
+	if (b->death < now)
+	    b->death = now;
+	heap_push(b->reallocs_left ?
+		  now + (b->death - now) / (b->reallocs_left + 1) :
+		  b->death, ev.id);
+    }
+    else {
+	emit(FREE, ev.id, 0);
+	live -= b->size;
+    }
+}
+
+/*
+ * emit - Append one request to the trace
+ */
+static void emit(int type, int index, int size)
+{
+    if (num_ops == 0x7fffffff)
+	gen_error("Trace has too many requests");
+    ops = grow(ops, &ops_cap, num_ops + 1, sizeof(traceop_t));
+    ops[num_ops].type = type;
+    ops[num_ops].index = index;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * heap_push, heap_pop - Binary min-heap of pending events by time
+ */
+static void heap_push(long long time, int id)
+{
+    int i, parent;
+    event_t tmp;
+
+    heap = grow(heap, &heap_cap, heap_len + 1, sizeof(event_t));
+    i = heap_len++;
+    heap[i].time = time;
+    heap[i].id = id;
+    while (i > 0 && heap[parent = (i - 1) / 2].time > heap[i].time) {
+	tmp = heap[parent];
+	heap[parent] = heap[i];
+	heap[i] = tmp;
+	i = parent;
+    }
+}
+
+static event_t heap_pop(void)
+{
+    event_t top = heap[0], tmp;
+    int i = 0, child;
+
+    heap[0] = heap[--heap_len];
+    while ((child = 2 * i + 1) < heap_len) {
+	if (child + 1 < heap_len && heap[child + 1].time < heap[child].time)
+	    child++;
+	if (heap[i].time <= heap[child].time)
+	    break;
+	tmp = heap[child];
+	heap[child] = heap[i];
+	heap[i] = tmp;
+	i = child;
+    }
+    return top;
+}
+
+/*
+ * sample_size - Draw a request size from the phase's mixture
+ */
+static int sample_size(phase_t *ph)
+{
+    double u = uniform() * ph->total_weight;
+    sizeclass_t *sc = &ph->classes[ph->nclasses - 1];
+    int i;
+
+    for (i = 0; i < ph->nclasses; i++) {
+	if (u < ph->classes[i].weight) {
+	    sc = &ph->classes[i];
+	    break;
+	}
+	u -= ph->classes[i].weight;
+    }
+    return sc->lo + (int)(uniform() * (sc->hi - sc->lo + 1));
+}
+
+/*
+ * sample_life - Draw a block lifetime (in requests) from the phase's
+ *     lifetime distribution
+ */
+static long long sample_life(phase_t *ph)
+{
+    double u = uniform();
+    double life;
+
+    if (ph->life == LIFE_EXP)
+	life = -ph->life_a * log(1.0 - u);
+    else
+	life = ph->life_b / pow(1.0 - u, 1.0 / ph->life_a);
+    if (life > 1e15)
+	life = 1e15;
+    return (long long)life + 1;
+}
+
+/*
+ * uniform - Uniform double in [0, 1) from a splitmix64 generator
+ */
+static double uniform(void)
+{
+    unsigned long long z = (rng_state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * parse_sizes - Parse a size mixture "lo[-hi]:weight,..."
+ */
+static void parse_sizes(phase_t *ph, char *spec)
+{
+    char *p = spec, *end;
+    sizeclass_t *sc;
+
+    ph->nclasses = 0;
+    ph->total_weight = 0;
+    while (*p) {
+	if (ph->nclasses == MAXCLASSES)
+	    gen_error("Too many size classes");
+	sc = &ph->classes[ph->nclasses];
+	sc->lo = sc->hi = strtol(p, &end, 10);
+	if (*end == '-')
+	    sc->hi = strtol(end + 1, &end, 10);
+	if (*end != ':' || sc->lo < 1 || sc->hi < sc->lo)
+	    gen_error("Bad size mixture (want lo[-hi]:weight,...)");
+	sc->weight = strtod(end + 1, &end);
+	if (sc->weight <= 0 || (*end != ',' && *end != '\0'))
+	    gen_error("Bad size mixture (want lo[-hi]:weight,...)");
+	ph->total_weight += sc->weight;
+	ph->nclasses++;
+	p = (*end == ',') ? end + 1 : end;
+    }
+    if (ph->nclasses == 0)
+	gen_error("Empty size mixture");
+}
+
+/*
+ * parse_life - Parse a lifetime distribution "exp:mean" or
+ *     "pareto:alpha:min"
+ */
+static void parse_life(phase_t *ph, char *spec)
+{
+    if (sscanf(spec, "exp:%lf", &ph->life_a) == 1 && ph->life_a > 0)
+	ph->life = LIFE_EXP;
+    else if (sscanf(spec, "pareto:%lf:%lf", &ph->life_a, &ph->life_b) == 2 &&
+	     ph->life_a > 0 && ph->life_b > 0)
+	ph->life = LIFE_PARETO;
+    else
+	gen_error("Bad lifetime (want exp:mean or pareto:alpha:min)");
+}
+
+/*
+ * parse_chain - Parse realloc growth chains "prob:factor:length"
+ */
+static void parse_chain(phase_t *ph, char *spec)
+{
+    if (sscanf(spec, "%lf:%lf:%d", &ph->chain_prob, &ph->chain_factor,
+	       &ph->chain_len) != 3 || ph->chain_prob < 0 ||
+	ph->chain_factor <= 0 || ph->chain_len < 0)
+	gen_error("Bad realloc chain (want prob:factor:length)");
+}
+
+/*
+ * parse_bytes - Parse a byte count with an optional K, M or G suffix
+ */
+static long long parse_bytes(char *s)
+{
+    char *end;
+    long long n = strtoll(s, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g': n <<= 10; /* fall through */
+    case 'M': case 'm': n <<= 10; /* fall through */
+    case 'K': case 'k': n <<= 10;
+    }
+    return n;
+}
+
+/*
+ * grow - Make sure the array p of *cap elements has room for need
+ *     elements, doubling it if not
+ */
+static void *grow(void *p, int *cap, int need, size_t elsize)
+{
+    if (need <= *cap)
+	return p;
+    *cap = (*cap == 0) ? 1024 : *cap * 2;
+    if ((p = realloc(p, (size_t)*cap * elsize)) == NULL)
+	gen_error("Out of memory");
+    return p;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-hb] [-S <seed>] [-m <bytes>] "
+	    "[-n <ops> [-s <sizes>] [-l <life>] [-g <chain>]]... -o <file>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Write a binary trace instead of .rep.\n");
+    fprintf(stderr, "\t-g <chain> Realloc chains: prob:factor:length.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l <life>  Lifetimes: exp:mean or pareto:alpha:min.\n");
+    fprintf(stderr, "\t-m <bytes> Target peak live payload (K/M/G suffix).\n");
+    fprintf(stderr, "\t-n <ops>   Start a phase of <ops> requests.\n");
+    fprintf(stderr, "\t-o <file>  Write the trace to <file>.\n");
+    fprintf(stderr, "\t-s <sizes> Size mixture: lo[-hi]:weight,...\n");
+    fprintf(stderr, "\t-S <seed>  Random seed (default 1).\n");
+}
+
+/*
+ * gen_error - Report a fatal error
+ */
+static void gen_error(char *msg)
+{
+    fprintf(stderr, "tracegen: %s\n", msg);
+    exit(1);
+}
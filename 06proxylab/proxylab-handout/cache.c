@@ -1,147 +1,309 @@
 #include "cache.h"
 
-cache_t *new_cache(int max_size, int max_obj_size) {
+static unsigned int hash_key(char *host, char *port, char *uri) {
+  /* FNV-1A OVER HOST, PORT AND URI, EACH WITH ITS NUL */
+  unsigned int hash = 2166136261u;
+  char *parts[3] = { host, port, uri };
+  char *p;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    p = parts[i];
+    do {
+      hash ^= (unsigned char)*p;
+      hash *= 16777619u;
+    } while (*p++ != '\0');
+  }
+
+  return hash;
+}
+
+static int same_key(cache_obj_t *obj, char *host, char *port, char *uri) {
+  return !strcmp(obj->host, host) && !strcmp(obj->port, port) && !strcmp(obj->uri, uri);
+}
+
+static cache_shard_t *shard_of(cache_t *cache, unsigned int hash) {
+  /* SCRAMBLE SO THE SHARD DOES NOT DEPEND ON THE BITS PICKING THE BUCKET */
+  return &cache->shards[((hash * 2654435761u) >> 16) % cache->shard_count];
+}
+
+static cache_table_t *new_table(int bucket_count) {
+  cache_table_t *table = calloc(1, sizeof(cache_table_t) + bucket_count * sizeof(cache_node_t *));
+
+  if (table == NULL)
+    return NULL;
+  table->bucket_count = bucket_count;
+  return table;
+}
+
+static void destroy_object(void *obj) {
+  free_object(obj);
+}
+
+static void ring_unlink(cache_shard_t *shard, cache_obj_t *obj) {
+  if (obj->next == obj)
+    shard->hand = NULL;
+  else {
+    if (shard->hand == obj)
+      shard->hand = obj->next;
+    obj->prev->next = obj->next;
+    obj->next->prev = obj->prev;
+  }
+  obj->prev = NULL;
+  obj->next = NULL;
+}
+
+static void ring_insert(cache_shard_t *shard, cache_obj_t *obj) {
+  /* JUST BEHIND THE HAND, SO IT IS THE LAST ONE THE CLOCK REACHES */
+  if (shard->hand == NULL) {
+    obj->prev = obj;
+    obj->next = obj;
+    shard->hand = obj;
+  }
+  else {
+    obj->next = shard->hand;
+    obj->prev = shard->hand->prev;
+    obj->prev->next = obj;
+    shard->hand->prev = obj;
+  }
+}
+
+static cache_node_t **find_link(cache_table_t *table, cache_obj_t *obj) {
+  /* LINK POINTING AT THE NODE OF obj, WRITERS ONLY */
+  cache_node_t **link = &table->buckets[obj->hash & (table->bucket_count - 1)];
+
+  while ((*link)->obj != obj)
+    link = &(*link)->next;
+
+  return link;
+}
+
+static void remove_object(cache_shard_t *shard, cache_obj_t *obj) {
+  /* UNLINK, READERS ALREADY ON THE NODE OR OBJECT CAN FINISH WITH THEM */
+  cache_node_t **link = find_link(shard->table, obj), *node = *link;
+
+  __atomic_store_n(link, node->next, __ATOMIC_RELEASE);
+  ring_unlink(shard, obj);
+  shard->obj_count--;
+  shard->now_size -= obj->data_size;
+
+  epoch_retire(node, free);
+  epoch_retire(obj, destroy_object);
+}
+
+static void grow_table(cache_shard_t *shard) {
+  /* BUILD A TABLE TWICE AS LARGE WITH FRESH NODES, THEN SWITCH READERS TO IT */
+  cache_table_t *old = shard->table, *table = new_table(old->bucket_count * 2);
+  cache_node_t *node, *copy, *next;
+  int i;
+
+  if (table == NULL)
+    return;
+
+  for (i = 0; i < old->bucket_count; i++) {
+    for (node = old->buckets[i]; node != NULL; node = node->next) {
+      if ((copy = malloc(sizeof(cache_node_t))) == NULL)
+        unix_error("malloc error");
+      *copy = *node;
+      copy->next = table->buckets[node->hash & (table->bucket_count - 1)];
+      table->buckets[node->hash & (table->bucket_count - 1)] = copy;
+    }
+  }
+  __atomic_store_n(&shard->table, table, __ATOMIC_RELEASE);
+
+  for (i = 0; i < old->bucket_count; i++) {
+    for (node = old->buckets[i]; node != NULL; node = next) {
+      next = node->next;
+      epoch_retire(node, free);
+    }
+  }
+  epoch_retire(old, free);
+}
+
+cache_t *new_cache(int max_size, int max_obj_size, int shard_count) {
   /* CREATE NEW CACHE OBJECT */
   cache_t *result = malloc(sizeof(cache_t));
+  cache_shard_t *shard;
+  int i;
+
+  /* EVERY SHARD MUST HOLD THE LARGEST OBJECT */
+  if (shard_count < 1)
+    shard_count = 1;
+  while (shard_count > 1 && max_size / shard_count < max_obj_size)
+    shard_count--;
 
   result->max_size = max_size;
   result->max_obj_size = max_obj_size;
-  result->now_size = 0;
-  result->head = NULL;
-  Sem_init(&(result->mutex), 0, 1);
+  result->shard_count = shard_count;
+  if (posix_memalign((void **)&result->shards, CACHE_LINE, shard_count * sizeof(cache_shard_t)) != 0)
+    unix_error("posix_memalign error");
+
+  /* SPLIT THE BUDGET, TOTAL STAYS max_size */
+  for (i = 0; i < shard_count; i++) {
+    shard = &result->shards[i];
+    shard->max_size = max_size / shard_count + (i < max_size % shard_count);
+    shard->now_size = 0;
+    shard->obj_count = 0;
+    shard->table = new_table(MIN_BUCKETS);
+    shard->hand = NULL;
+    Sem_init(&(shard->mutex), 0, 1);
+  }
 
   return result;
 }
 
-cache_obj_t *find_cache(cache_t *cache, char *host, char *uri) {
-  cache_obj_t *iter_obj = cache->head, *temp;
+cache_obj_t *find_cache(cache_t *cache, char *host, char *port, char *uri, hazard_t *hz) {
+  /* LOCK FREE, A HIT STAYS VALID UNTIL THE CALLER CLEARS hz */
+  unsigned int hash = hash_key(host, port, uri);
+  cache_shard_t *shard = shard_of(cache, hash);
+  cache_table_t *table;
+  cache_node_t *node;
+  cache_obj_t *found = NULL;
 
-  /* TRAVERSE OBJ LIST */
-  while (iter_obj != NULL) {
-    temp = iter_obj;
-    iter_obj = iter_obj->next;
-
-    if (!strcmp(temp->host, host) && !strcmp(temp->uri, uri)) {
-      iter_obj = temp;
+  epoch_enter();
+  table = __atomic_load_n(&shard->table, __ATOMIC_ACQUIRE);
+  node = __atomic_load_n(&table->buckets[hash & (table->bucket_count - 1)], __ATOMIC_ACQUIRE);
+  while (node != NULL) {
+    if (node->hash == hash && same_key(node->obj, host, port, uri)) {
+      found = node->obj;
       break;
     }
+    node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
   }
 
-  /* UPDATE USED LOG */
-  if (iter_obj != NULL) {
-    temp = pop_object(cache, iter_obj);
-    time(&(temp->used_at));
-    push_front(cache, temp);
+  /* MARK USED, BUT ONLY WRITE THE LINE IF THE BIT WAS CLEARED */
+  if (found != NULL) {
+    if (!__atomic_load_n(&found->referenced, __ATOMIC_RELAXED))
+      __atomic_store_n(&found->referenced, 1, __ATOMIC_RELAXED);
+    hazard_set(hz, found);
   }
+  epoch_exit();
 
-  return iter_obj;
+  return found;
 }
 
 void free_cache(cache_t *cache) {
-  /* DELETE CACHE OBJECT */
-  cache_obj_t *iter_obj = cache->head, *temp;
-
-  while (iter_obj != NULL) {
-    temp = iter_obj;
-    iter_obj = iter_obj->next;
+  /* DELETE CACHE OBJECT, NO READERS MAY BE LEFT */
+  cache_shard_t *shard;
+  cache_node_t *node, *next;
+  int i, j;
 
-    free_object(temp);
+  for (i = 0; i < cache->shard_count; i++) {
+    shard = &cache->shards[i];
+    for (j = 0; j < shard->table->bucket_count; j++) {
+      for (node = shard->table->buckets[j]; node != NULL; node = next) {
+        next = node->next;
+        free_object(node->obj);
+        free(node);
+      }
+    }
+    free(shard->table);
   }
+  free(cache->shards);
+  free(cache);
 }
 
 void print_cache(cache_t *cache) {
   /* PRINT CACHED OBJECTS */
-  cache_obj_t *iter_obj = cache->head, *temp;
+  cache_shard_t *shard;
+  cache_obj_t *iter_obj;
+  int i;
 
-  printf("max_size: %d, max_obj_size: %d, now_size: %d\n", cache->max_size, cache->max_obj_size, cache->now_size);
+  printf("max_size: %d, max_obj_size: %d, shards: %d\n", cache->max_size, cache->max_obj_size, cache->shard_count);
 
-  printf("%-20s\t%-20s\t%-20s\t%-10s\t%-50s\n", "[timestamp]", "[host]", "[uri]", "[size]", "[data]");
-  while (iter_obj != NULL) {
-    temp = iter_obj;
-    iter_obj = iter_obj->next;
+  for (i = 0; i < cache->shard_count; i++) {
+    shard = &cache->shards[i];
+    P(&shard->mutex);
+    printf("shard %d: max_size: %d, now_size: %d, objects: %d, buckets: %d\n", i, shard->max_size, shard->now_size, shard->obj_count, shard->table->bucket_count);
 
-    printf("%-20ld\t%-20s\t%-20s\t%-10d\t%-50s\n", temp->used_at, temp->host, temp->uri, temp->data_size, temp->data);
+    printf("%-20s\t%-4s\t%-20s\t%-6s\t%-20s\t%-10s\t%-50s\n", "[timestamp]", "[ref]", "[host]", "[port]", "[uri]", "[size]", "[data]");
+    iter_obj = shard->hand;
+    while (iter_obj != NULL) {
+      printf("%-20ld\t%-4d\t%-20s\t%-6s\t%-20s\t%-10d\t%-50s\n", iter_obj->used_at, iter_obj->referenced, iter_obj->host, iter_obj->port, iter_obj->uri, iter_obj->data_size, iter_obj->data);
+
+      iter_obj = iter_obj->next;
+      if (iter_obj == shard->hand) break;
+    }
+    V(&shard->mutex);
+    printf("\n");
   }
-  printf("\n");
 }
 
-cache_obj_t *new_object(char *host, char *uri, char *header, char *data, int data_size) {
+cache_obj_t *new_object(char *host, char *port, char *uri, char *header, char *data, int data_size) {
   /* CREATE NEW CACHE OBJECT FROM DATA */
   cache_obj_t *created = malloc(sizeof(cache_obj_t));
   created->header = malloc(sizeof(char) * (strlen(header)+1));
   created->data = malloc(sizeof(char) * data_size);
   created->data_size = data_size;
+  created->referenced = 0;
+  created->prev = NULL;
+  created->next = NULL;
   time(&(created->used_at));
 
-  strcpy(created->host, host);
-  strcpy(created->uri, uri);
+  strncpy(created->host, host, MAX_HOST_LEN - 1);
+  created->host[MAX_HOST_LEN - 1] = '\0';
+  strncpy(created->port, port, MAX_PORT_LEN - 1);
+  created->port[MAX_PORT_LEN - 1] = '\0';
+  strncpy(created->uri, uri, MAX_HOST_LEN - 1);
+  created->uri[MAX_HOST_LEN - 1] = '\0';
+  created->hash = hash_key(created->host, created->port, created->uri);
   strcpy(created->header, header);
   memcpy(created->data, data, data_size);
 
   return created;
 }
 
-int push_front(cache_t *cache, cache_obj_t *obj) {
+int push_front(cache_t *root, cache_obj_t *obj) {
+  cache_shard_t *cache = shard_of(root, obj->hash);
+  cache_node_t *node, *iter_node, **bucket;
+  cache_obj_t *victim;
+
   /* CHECK OBJ SIZE */
-  if (cache->max_obj_size < obj->data_size) {
+  if (root->max_obj_size < obj->data_size || cache->max_size < obj->data_size) {
     return -1;
   }
+  if ((node = malloc(sizeof(cache_node_t))) == NULL)
+    return -1;
 
-  /* CHECK AND CREATE CACHE SPACE */
-  while (cache->max_size - cache->now_size < obj->data_size) {
-    cache_obj_t *last = cache->head;
-    while (last != NULL && last->next != NULL) last = last->next;
+  P(&cache->mutex);
 
-    free_object(pop_object(cache, last));
+  /* REPLACE AN OLDER COPY OF THE SAME OBJECT */
+  iter_node = cache->table->buckets[obj->hash & (cache->table->bucket_count - 1)];
+  while (iter_node != NULL) {
+    if (iter_node->hash == obj->hash && same_key(iter_node->obj, obj->host, obj->port, obj->uri)) {
+      remove_object(cache, iter_node->obj);
+      break;
+    }
+    iter_node = iter_node->next;
   }
 
-  /* PUSH CASH OBJECT */
-  if (cache->head == NULL) {
-    obj->prev = NULL;
-    obj->next = NULL;
-    cache->head = obj;
-  }
-  else {
-    obj->prev = NULL;
-    obj->next = cache->head;
-    obj->next->prev = obj;
-    cache->head = obj;
+  /* CHECK AND CREATE CACHE SPACE, THE CLOCK SPARES WHAT WAS HIT SINCE ITS LAST TURN */
+  while (cache->max_size - cache->now_size < obj->data_size) {
+    victim = cache->hand;
+    if (__atomic_load_n(&victim->referenced, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&victim->referenced, 0, __ATOMIC_RELAXED);
+      cache->hand = victim->next;
+    }
+    else
+      remove_object(cache, victim);
   }
-  cache->now_size += obj->data_size;
 
-  return 0;
-}
+  /* PUSH CASH OBJECT */
+  ring_insert(cache, obj);
+  cache->now_size += obj->data_size;
 
-cache_obj_t *pop_object(cache_t *cache, cache_obj_t *obj) {
-  if (obj->prev == NULL && obj->next == NULL) {
-    // only object in cache
-    cache->head = NULL;
-    obj->prev = NULL;
-    obj->next = NULL;
-  }
-  else if (obj->prev == NULL) {
-    // head object in cache
-    cache->head = obj->next;
-    cache->head->prev = NULL;
-    obj->prev = NULL;
-    obj->next = NULL;
-  }
-  else if (obj->next == NULL) {
-    // tail object in cache
-    obj->prev->next = NULL;
-    obj->prev = NULL;
-    obj->next = NULL;
-  }
-  else  {
-    // middle object in cache
-    obj->prev->next = obj->next;
-    obj->next->prev = obj->prev;
-    obj->prev = NULL;
-    obj->next = NULL;
-  }
+  /* PUBLISH IT IN ITS BUCKET */
+  if (cache->obj_count >= cache->table->bucket_count)
+    grow_table(cache);
+  bucket = &cache->table->buckets[obj->hash & (cache->table->bucket_count - 1)];
+  node->hash = obj->hash;
+  node->obj = obj;
+  node->next = *bucket;
+  __atomic_store_n(bucket, node, __ATOMIC_RELEASE);
+  cache->obj_count++;
+  V(&cache->mutex);
 
-  cache->now_size -= obj->data_size;
-  return obj;
+  return 0;
 }
 
 void free_object(cache_obj_t *obj) {
@@ -150,11 +312,3 @@ void free_object(cache_obj_t *obj) {
   free(obj->header);
   free(obj);
 }
-
-void P_cache(cache_t *cache) {
-  P(&cache->mutex);
-}
-
-void V_cache(cache_t *cache) {
-  V(&cache->mutex);
-}
@@ -1,37 +1,71 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include "csapp.h"
+#include "epoch.h"
 
 #define MAX_HOST_LEN 1024
+#define MAX_PORT_LEN 16
+#define MIN_BUCKETS  64
 
 typedef struct cache_obj {
   char host[MAX_HOST_LEN];
+  char port[MAX_PORT_LEN];
   char uri[MAX_HOST_LEN];
+  unsigned int hash;
   char *header;
   char *data;
   int data_size;
-  time_t used_at;
-  struct cache_obj *prev;
+  time_t used_at;               /* WHEN IT WAS CACHED */
+  int referenced;               /* CLOCK BIT, SET BY HITS AND CLEARED BY THE HAND */
+  struct cache_obj *prev;       /* CLOCK RING OF THE SHARD, ONLY WRITERS TOUCH IT */
   struct cache_obj *next;
 } cache_obj_t;
 
+/* HASH CHAIN ENTRY, NEVER CHANGED WHILE READERS MAY SEE IT EXCEPT FOR next */
+typedef struct cache_node {
+  unsigned int hash;
+  cache_obj_t *obj;
+  struct cache_node *next;
+} cache_node_t;
+
+typedef struct {
+  int bucket_count;             /* ALWAYS A POWER OF TWO */
+  cache_node_t *buckets[];
+} cache_table_t;
+
+/*
+ * ONE SHARD: ITS OWN BYTE BUDGET, HASH TABLE AND CLOCK RING. LOOKUPS
+ * TAKE NO LOCK AND WRITE NOTHING SHARED UNLESS THE CLOCK BIT IS CLEAR,
+ * INSERTS AND EVICTIONS ARE SERIALIZED BY THE MUTEX. REPLACED TABLES,
+ * NODES AND EVICTED OBJECTS ARE FREED THROUGH epoch_retire.
+ */
 typedef struct {
   int max_size;
-  int max_obj_size;
   int now_size;
+  int obj_count;
+  cache_table_t *table;
   sem_t mutex;
-  cache_obj_t *head;
+  cache_obj_t *hand;            /* NEXT OBJECT THE CLOCK LOOKS AT */
+} __attribute__((aligned(CACHE_LINE))) cache_shard_t;
+
+typedef struct {
+  int max_size;
+  int max_obj_size;
+  int shard_count;
+  cache_shard_t *shards;        /* AN OBJECT LIVES IN THE SHARD ITS KEY HASHES TO */
 } cache_t;
 
-cache_t *new_cache(int max_size, int max_obj_size);
-cache_obj_t *find_cache(cache_t *cache, char *host, char *uri);
+cache_t *new_cache(int max_size, int max_obj_size, int shard_count);
+cache_obj_t *find_cache(cache_t *cache, char *host, char *port, char *uri, hazard_t *hz);
 void free_cache(cache_t *cache);
 void print_cache(cache_t *cache);
-cache_obj_t *new_object(char *host, char *uri, char *header, char *data, int data_size);
+cache_obj_t *new_object(char *host, char *port, char *uri, char *header, char *data, int data_size);
 int push_front(cache_t *cache, cache_obj_t *obj);
-cache_obj_t *pop_object(cache_t *cache, cache_obj_t *obj);
 void free_object(cache_obj_t *obj);
-void P_cache(cache_t *cache);
-void V_cache(cache_t *cache);
\ No newline at end of file
+
+#endif /* __CACHE_H__ */
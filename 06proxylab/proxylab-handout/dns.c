@@ -0,0 +1,326 @@
+#include <sys/eventfd.h>
+#include "dns.h"
+
+static unsigned int hash_name(char *host, char *port) {
+  /* FNV-1A OVER HOST AND PORT, EACH WITH ITS NUL */
+  unsigned int hash = 2166136261u;
+  char *p;
+
+  for (p = host; ; p++) {
+    hash = (hash ^ (unsigned char)*p) * 16777619u;
+    if (*p == '\0')
+      break;
+  }
+  for (p = port; ; p++) {
+    hash = (hash ^ (unsigned char)*p) * 16777619u;
+    if (*p == '\0')
+      break;
+  }
+  return hash;
+}
+
+static dns_entry_t *resolve(dns_t *dns, char *host, char *port) {
+  /* ASK THE SYSTEM RESOLVER, THE ANSWER OR THE FAILURE BECOMES A NEW ENTRY */
+  dns_entry_t *entry = calloc(1, sizeof(dns_entry_t));
+  struct addrinfo hints, *list, *p;
+
+  if (entry == NULL)
+    return NULL;
+  strncpy(entry->host, host, MAX_HOST_LEN - 1);
+  strncpy(entry->port, port, MAX_PORT_LEN - 1);
+  entry->hash = hash_name(entry->host, entry->port);
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+  if ((entry->rc = getaddrinfo(host, port, &hints, &list)) != 0) {
+    entry->expires = time(NULL) + dns->negative_ttl;
+    return entry;
+  }
+
+  for (p = list; p != NULL && entry->count < DNS_MAX_ADDRS; p = p->ai_next) {
+    entry->addrs[entry->count].family = p->ai_family;
+    entry->addrs[entry->count].socktype = p->ai_socktype;
+    entry->addrs[entry->count].protocol = p->ai_protocol;
+    entry->addrs[entry->count].addrlen = p->ai_addrlen;
+    memcpy(&entry->addrs[entry->count].addr, p->ai_addr, p->ai_addrlen);
+    entry->count++;
+  }
+  freeaddrinfo(list);
+  entry->expires = time(NULL) + dns->ttl;
+
+  return entry;
+}
+
+static void publish(dns_t *dns, dns_entry_t *entry) {
+  /* PUT entry IN FRONT OF ITS BUCKET, RETIRING THE ONE IT REPLACES */
+  dns_entry_t **bucket = &dns->buckets[entry->hash % DNS_BUCKETS], **link, *old;
+
+  P(&dns->mutex);
+  for (link = bucket; (old = *link) != NULL; link = &old->next) {
+    if (old->hash == entry->hash && !strcmp(old->host, entry->host) && !strcmp(old->port, entry->port)) {
+      __atomic_store_n(link, old->next, __ATOMIC_RELEASE);
+      epoch_retire(old, free);
+      break;
+    }
+  }
+  entry->next = *bucket;
+  __atomic_store_n(bucket, entry, __ATOMIC_RELEASE);
+  V(&dns->mutex);
+}
+
+static void extend(dns_t *dns, char *host, char *port, time_t expires) {
+  /* A FAILED REFRESH KEEPS THE ADDRESSES THAT STILL WORK A LITTLE LONGER,
+     BUT ONLY ONCE MORE UNLESS SOMEONE USES THEM AGAIN */
+  unsigned int hash = hash_name(host, port);
+  dns_entry_t *entry;
+
+  P(&dns->mutex);
+  for (entry = dns->buckets[hash % DNS_BUCKETS]; entry != NULL; entry = entry->next) {
+    if (entry->hash == hash && !strcmp(entry->host, host) && !strcmp(entry->port, port)) {
+      if (entry->rc == 0) {
+        __atomic_store_n(&entry->expires, expires, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->used, 0, __ATOMIC_RELAXED);
+      }
+      break;
+    }
+  }
+  V(&dns->mutex);
+}
+
+static int copy_out(dns_entry_t *entry, dns_addr_t *addrs, int max) {
+  int count = entry->count < max ? entry->count : max;
+
+  if (entry->rc != 0)
+    return entry->rc;
+  memcpy(addrs, entry->addrs, count * sizeof(dns_addr_t));
+  return count;
+}
+
+static void *refresher(void *vargp) {
+  /* ONCE A SECOND, RE-RESOLVE WHAT IS IN USE AND ABOUT TO EXPIRE, DROP WHAT IS NOT */
+  dns_t *dns = vargp;
+  int ahead = dns->ttl / 5 > 1 ? dns->ttl / 5 : 1;
+  char (*hosts)[MAX_HOST_LEN] = NULL, (*ports)[MAX_PORT_LEN] = NULL;
+  int count, cap = 0, i;
+  dns_entry_t **link, *entry;
+  time_t now;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    sleep(1);
+    now = time(NULL);
+    count = 0;
+
+    P(&dns->mutex);
+    for (i = 0; i < DNS_BUCKETS; i++) {
+      link = &dns->buckets[i];
+      while ((entry = *link) != NULL) {
+        if (entry->expires - now > ahead) {
+          link = &entry->next;
+          continue;
+        }
+        if (entry->rc == 0 && __atomic_load_n(&entry->used, __ATOMIC_RELAXED)) {
+          if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            if ((hosts = realloc(hosts, cap * sizeof(*hosts))) == NULL ||
+                (ports = realloc(ports, cap * sizeof(*ports))) == NULL)
+              unix_error("realloc error");
+          }
+          strcpy(hosts[count], entry->host);
+          strcpy(ports[count], entry->port);
+          count++;
+          link = &entry->next;
+        }
+        else if (entry->expires <= now) {
+          /* UNUSED OR FAILED, LET THE NEXT LOOKUP RESOLVE IT AGAIN */
+          __atomic_store_n(link, entry->next, __ATOMIC_RELEASE);
+          epoch_retire(entry, free);
+        }
+        else
+          link = &entry->next;
+      }
+    }
+    V(&dns->mutex);
+
+    /* THE RESOLVER MAY BE SLOW, SO ASK IT WITHOUT THE MUTEX. ONLY A MISS
+       PUBLISHES A FAILURE, HERE IT WOULD HIDE ADDRESSES THAT STILL WORK.
+       A NAME THAT IS GONE (EAI_NONAME AND THE LIKE) IS LEFT TO EXPIRE,
+       ONLY A RESOLVER THAT COULD NOT ANSWER EXTENDS THE OLD ADDRESSES */
+    for (i = 0; i < count; i++) {
+      if ((entry = resolve(dns, hosts[i], ports[i])) == NULL)
+        continue;
+      if (entry->rc == 0)
+        publish(dns, entry);
+      else {
+        if (entry->rc == EAI_AGAIN || entry->rc == EAI_SYSTEM)
+          extend(dns, hosts[i], ports[i], time(NULL) + ahead + dns->negative_ttl);
+        free(entry);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+dns_t *new_dns(int ttl, int negative_ttl) {
+  dns_t *dns = calloc(1, sizeof(dns_t));
+  pthread_t tid;
+
+  if (dns == NULL)
+    unix_error("calloc error");
+  dns->ttl = ttl;
+  dns->negative_ttl = negative_ttl;
+  Sem_init(&dns->mutex, 0, 1);
+  Sem_init(&dns->jobs_mutex, 0, 1);
+  Sem_init(&dns->jobs_items, 0, 0);
+  if (ttl > 0)
+    Pthread_create(&tid, NULL, refresher, dns);
+
+  return dns;
+}
+
+int dns_cached(dns_t *dns, char *host, char *port, dns_addr_t *addrs, int max, int *result) {
+  /* 1 AND THE ANSWER IN *result IF host:port IS CACHED, 0 IF IT MUST BE RESOLVED */
+  unsigned int hash;
+  dns_entry_t *entry;
+
+  if (dns->ttl == 0)
+    return 0;
+  if (*port == '\0')
+    port = "80";
+  hash = hash_name(host, port);
+  epoch_enter();
+  entry = __atomic_load_n(&dns->buckets[hash % DNS_BUCKETS], __ATOMIC_ACQUIRE);
+  while (entry != NULL) {
+    if (entry->hash == hash && !strcmp(entry->host, host) && !strcmp(entry->port, port))
+      break;
+    entry = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+  }
+  if (entry != NULL && time(NULL) < __atomic_load_n(&entry->expires, __ATOMIC_RELAXED)) {
+    /* MARK USED, BUT ONLY WRITE THE LINE IF THE FLAG WAS CLEAR */
+    if (!__atomic_load_n(&entry->used, __ATOMIC_RELAXED))
+      __atomic_store_n(&entry->used, 1, __ATOMIC_RELAXED);
+    *result = copy_out(entry, addrs, max);
+    epoch_exit();
+    return 1;
+  }
+  epoch_exit();
+  return 0;
+}
+
+int dns_resolve(dns_t *dns, char *host, char *port, dns_addr_t *addrs, int max) {
+  /* UP TO max ADDRESSES OF host:port AND THEIR COUNT, OR A getaddrinfo ERROR */
+  dns_entry_t *entry;
+  int result;
+
+  if (dns_cached(dns, host, port, addrs, max, &result))
+    return result;
+  if (*port == '\0')
+    port = "80";
+
+  /* MISSING OR EXPIRED, RESOLVE IT HERE */
+  if ((entry = resolve(dns, host, port)) == NULL)
+    return EAI_MEMORY;
+  result = copy_out(entry, addrs, max);
+  if (dns->ttl > 0)
+    publish(dns, entry);
+  else
+    free(entry);
+
+  return result;
+}
+
+int dns_connect(dns_t *dns, char *host, char *port) {
+  /* open_clientfd THROUGH THE CACHE: -2 IF THE NAME DOES NOT RESOLVE, -1 IF NO ADDRESS CONNECTS */
+  dns_addr_t addrs[DNS_MAX_ADDRS];
+  int count, fd, i;
+
+  if ((count = dns_resolve(dns, host, port, addrs, DNS_MAX_ADDRS)) < 0) {
+    fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", host, port, gai_strerror(count));
+    return -2;
+  }
+
+  for (i = 0; i < count; i++) {
+    if ((fd = socket(addrs[i].family, addrs[i].socktype, addrs[i].protocol)) < 0)
+      continue;
+    if (connect(fd, (struct sockaddr *)&addrs[i].addr, addrs[i].addrlen) != -1)
+      return fd;
+    close(fd);
+  }
+  return -1;
+}
+
+static void *resolver(void *vargp) {
+  /* ANSWER QUERIES FROM THE EVENT LOOPS, EACH GOES BACK TO ITS OWN LOOP */
+  dns_t *dns = vargp;
+  dns_query_t *query;
+  dns_inbox_t *inbox;
+  uint64_t one = 1;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    P(&dns->jobs_items);
+    P(&dns->jobs_mutex);
+    query = dns->jobs;
+    if ((dns->jobs = query->next) == NULL)
+      dns->jobs_tail = NULL;
+    V(&dns->jobs_mutex);
+
+    query->result = dns_resolve(dns, query->host, query->port, query->addrs, DNS_MAX_ADDRS);
+
+    inbox = query->inbox;
+    P(&inbox->mutex);
+    query->next = inbox->head;
+    inbox->head = query;
+    V(&inbox->mutex);
+    if (write(inbox->fd, &one, sizeof(one)) < 0)
+      unix_error("eventfd write error");
+  }
+
+  return NULL;
+}
+
+void dns_inbox_init(dns_t *dns, dns_inbox_t *inbox) {
+  /* AN EMPTY INBOX FOR ONE LOOP, AND THE RESOLVER THREADS IF THEY ARE NOT RUNNING YET */
+  pthread_t tid;
+  int i;
+
+  if ((inbox->fd = eventfd(0, EFD_CLOEXEC)) < 0)
+    unix_error("eventfd error");
+  inbox->head = NULL;
+  Sem_init(&inbox->mutex, 0, 1);
+
+  P(&dns->jobs_mutex);
+  if (!dns->resolvers) {
+    dns->resolvers = DNS_RESOLVERS;
+    for (i = 0; i < DNS_RESOLVERS; i++)
+      Pthread_create(&tid, NULL, resolver, dns);
+  }
+  V(&dns->jobs_mutex);
+}
+
+void dns_submit(dns_t *dns, dns_inbox_t *inbox, dns_query_t *query) {
+  /* QUEUE query, IN ORDER, FOR THE NEXT FREE RESOLVER THREAD */
+  query->inbox = inbox;
+  query->next = NULL;
+  P(&dns->jobs_mutex);
+  if (dns->jobs_tail != NULL)
+    dns->jobs_tail->next = query;
+  else
+    dns->jobs = query;
+  dns->jobs_tail = query;
+  V(&dns->jobs_mutex);
+  V(&dns->jobs_items);
+}
+
+dns_query_t *dns_take(dns_inbox_t *inbox) {
+  /* EVERY ANSWERED QUERY IN THE INBOX, READ ITS eventfd FIRST */
+  dns_query_t *head;
+
+  P(&inbox->mutex);
+  head = inbox->head;
+  inbox->head = NULL;
+  V(&inbox->mutex);
+  return head;
+}
@@ -0,0 +1,97 @@
+#ifndef __DNS_H__
+#define __DNS_H__
+
+#include "cache.h"
+
+#define DNS_BUCKETS    256
+#define DNS_MAX_ADDRS  8
+#define DNS_RESOLVERS  4        /* THREADS ANSWERING EVENT LOOP MISSES */
+
+/*
+ * RESOLVER CACHE
+ *
+ * getaddrinfo RESULTS KEYED ON host:port, KEPT FOR ttl SECONDS (FAILURES
+ * FOR negative_ttl). LOOKUPS TAKE NO LOCK: ONLY THE EXPIRY OF AN ENTRY
+ * CHANGES ONCE IT IS PUBLISHED, READERS WALK THE BUCKETS INSIDE AN EPOCH
+ * AND WRITERS SWAP IN A NEW ENTRY AND RETIRE THE OLD ONE. A REFRESHER
+ * THREAD RESOLVES ENTRIES THAT WERE USED AGAIN SHORTLY BEFORE THEY
+ * EXPIRE, SO A BUSY ORIGIN NEVER WAITS ON THE RESOLVER, AND DROPS THE
+ * ONES NOBODY USED. IF SUCH A REFRESH FAILS BECAUSE THE RESOLVER COULD
+ * NOT ANSWER (EAI_AGAIN, EAI_SYSTEM) THE OLD ADDRESSES STAY IN USE AND
+ * IT IS TRIED AGAIN negative_ttl SECONDS LATER, IF THEY WERE USED IN
+ * BETWEEN. ANY OTHER FAILURE LETS THE ENTRY EXPIRE, AND THE NEXT LOOKUP
+ * CACHES THE FAILURE.
+ */
+
+typedef struct {
+  int family;
+  int socktype;
+  int protocol;
+  socklen_t addrlen;
+  struct sockaddr_storage addr;
+} dns_addr_t;
+
+typedef struct dns_entry {
+  char host[MAX_HOST_LEN];
+  char port[MAX_PORT_LEN];
+  unsigned int hash;
+  int rc;                       /* getaddrinfo ERROR, 0 IF addrs ARE VALID */
+  int count;
+  dns_addr_t addrs[DNS_MAX_ADDRS];
+  time_t expires;
+  int used;                     /* LOOKED UP SINCE IT WAS RESOLVED */
+  struct dns_entry *next;
+} dns_entry_t;
+
+/*
+ * ASYNC LOOKUPS
+ *
+ * AN EVENT LOOP MUST NOT WAIT ON getaddrinfo. IT ASKS THE CACHE WITH
+ * dns_cached, AND ON A MISS HANDS A QUERY TO THE RESOLVER THREADS WITH
+ * dns_submit. THE ANSWERED QUERY IS PUT IN THE LOOP'S INBOX, WHOSE
+ * eventfd THEN BECOMES READABLE. THE LOOP READS THE eventfd, SO THAT IT
+ * IS QUIET AGAIN, AND THEN COLLECTS THE ANSWERS WITH dns_take.
+ */
+
+struct dns_inbox;
+
+typedef struct dns_query {
+  char host[MAX_HOST_LEN];
+  char port[MAX_PORT_LEN];
+  dns_addr_t addrs[DNS_MAX_ADDRS];
+  int result;                   /* ADDRESS COUNT OR getaddrinfo ERROR */
+  void *owner;                  /* THE CONNECTION WAITING FOR IT */
+  struct dns_inbox *inbox;
+  struct dns_query *next;
+} dns_query_t;
+
+typedef struct dns_inbox {
+  int fd;                       /* BLOCKING eventfd, READABLE ONCE head FILLS */
+  dns_query_t *head;
+  sem_t mutex;
+} dns_inbox_t;
+
+typedef struct {
+  int ttl;                      /* 0 DISABLES THE CACHE */
+  int negative_ttl;
+  dns_entry_t *buckets[DNS_BUCKETS];
+  sem_t mutex;                  /* WRITERS ONLY */
+
+  /* QUERIES WAITING FOR A RESOLVER THREAD */
+  dns_query_t *jobs;
+  dns_query_t *jobs_tail;
+  sem_t jobs_mutex;
+  sem_t jobs_items;
+  int resolvers;                /* STARTED ON THE FIRST dns_inbox_init */
+} dns_t;
+
+dns_t *new_dns(int ttl, int negative_ttl);
+int dns_resolve(dns_t *dns, char *host, char *port, dns_addr_t *addrs, int max);
+int dns_connect(dns_t *dns, char *host, char *port);
+
+int dns_cached(dns_t *dns, char *host, char *port, dns_addr_t *addrs, int max, int *result);
+void dns_inbox_init(dns_t *dns, dns_inbox_t *inbox);
+void dns_submit(dns_t *dns, dns_inbox_t *inbox, dns_query_t *query);
+dns_query_t *dns_take(dns_inbox_t *inbox);
+
+#endif /* __DNS_H__ */
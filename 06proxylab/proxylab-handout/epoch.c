@@ -0,0 +1,253 @@
+#include <stdint.h>
+#include "epoch.h"
+
+/* RETIRED NODES KEPT PER THREAD BEFORE TRYING TO FREE SOME, AND READS
+   BETWEEN TRIES WHILE A THREAD HAS NOTHING NEW TO RETIRE */
+#define RECLAIM_EVERY 32
+
+typedef struct limbo {
+  void *ptr;
+  void (*destroy)(void *);
+  unsigned long epoch;          /* GLOBAL EPOCH WHEN RETIRED */
+  struct limbo *next;
+} limbo_t;
+
+/* ONE PER THREAD, REUSED BY LATER THREADS ONCE ITS OWNER EXITS, SPARE SLOTS AND ALL */
+typedef struct record {
+  unsigned long state;          /* EPOCH << 1 | 1 WHILE READING, ELSE 0 */
+  int in_use;
+  limbo_t *limbo;               /* NODES THIS RECORD RETIRED */
+  int limbo_count;
+  unsigned long reclaimed;      /* GLOBAL EPOCH AT THE LAST reclaim */
+  unsigned exits;               /* epoch_exit CALLS SINCE THEN */
+  hazard_t *hazard;             /* THE THREAD'S OWN HAZARD SLOT */
+  hazard_t *spare;              /* RELEASED SLOTS, FOR THE NEXT hazard_acquire */
+  void **held;                  /* SORTED HAZARD POINTERS, FOR reclaim */
+  size_t held_cap;
+  struct record *next;
+} __attribute__((aligned(CACHE_LINE))) record_t;
+
+static unsigned long global_epoch = 1;
+static record_t *records = NULL;
+static hazard_t *hazards = NULL;
+
+static __thread record_t *my_record = NULL;
+static pthread_key_t record_key;
+static pthread_once_t record_once = PTHREAD_ONCE_INIT;
+
+static void release_record(void *vrec) {
+  /* THREAD EXIT, ITS LIMBO IS LEFT FOR THE NEXT OWNER */
+  record_t *rec = vrec;
+
+  hazard_clear(rec->hazard);
+  __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void make_key(void) {
+  pthread_key_create(&record_key, release_record);
+}
+
+static hazard_t *new_hazard(void) {
+  hazard_t *hz;
+
+  if (posix_memalign((void **)&hz, CACHE_LINE, sizeof(hazard_t)) != 0)
+    abort();
+  hz->ptr = NULL;
+  hz->spare = NULL;
+  hz->next = __atomic_load_n(&hazards, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&hazards, &hz->next, hz, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return hz;
+}
+
+static record_t *get_record(void) {
+  record_t *rec;
+  int expected;
+
+  if (my_record != NULL)
+    return my_record;
+
+  /* CLAIM A FREE RECORD, OR PUSH A NEW ONE */
+  for (rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->next) {
+    expected = 0;
+    if (__atomic_load_n(&rec->in_use, __ATOMIC_RELAXED) == 0 &&
+        __atomic_compare_exchange_n(&rec->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      break;
+  }
+  if (rec == NULL) {
+    if (posix_memalign((void **)&rec, CACHE_LINE, sizeof(record_t)) != 0)
+      abort();
+    rec->state = 0;
+    rec->in_use = 1;
+    rec->limbo = NULL;
+    rec->limbo_count = 0;
+    rec->reclaimed = 0;
+    rec->exits = 0;
+    rec->hazard = new_hazard();
+    rec->spare = NULL;
+    rec->held = NULL;
+    rec->held_cap = 0;
+    rec->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&records, &rec->next, rec, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+
+  pthread_once(&record_once, make_key);
+  pthread_setspecific(record_key, rec);
+  my_record = rec;
+  return rec;
+}
+
+void epoch_enter(void) {
+  record_t *rec = get_record();
+  unsigned long epoch;
+
+  /* ANNOUNCE THE EPOCH, AND RETRY IF IT MOVED BEFORE OTHERS COULD SEE US */
+  do {
+    epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&rec->state, (epoch << 1) | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  } while (__atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) != epoch);
+}
+
+static void try_advance(void) {
+  /* MOVE ON ONCE EVERY ACTIVE READER HAS SEEN THE CURRENT EPOCH */
+  unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE), state;
+  record_t *rec;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->next) {
+    state = __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE);
+    if ((state & 1) && (state >> 1) != epoch)
+      return;
+  }
+  __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static int compare_ptrs(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)*(void * const *)a, y = (uintptr_t)*(void * const *)b;
+
+  return (x > y) - (x < y);
+}
+
+static size_t snapshot_hazards(record_t *rec) {
+  /* EVERY PROTECTED NODE, SORTED INTO rec->held */
+  hazard_t *hz;
+  void *ptr;
+  size_t n = 0;
+
+  for (hz = __atomic_load_n(&hazards, __ATOMIC_ACQUIRE); hz != NULL; hz = hz->next) {
+    if ((ptr = __atomic_load_n(&hz->ptr, __ATOMIC_ACQUIRE)) == NULL)
+      continue;
+    if (n == rec->held_cap) {
+      rec->held_cap = rec->held_cap ? rec->held_cap * 2 : 64;
+      if ((rec->held = realloc(rec->held, rec->held_cap * sizeof(void *))) == NULL)
+        abort();
+    }
+    rec->held[n++] = ptr;
+  }
+  qsort(rec->held, n, sizeof(void *), compare_ptrs);
+  return n;
+}
+
+static void reclaim(record_t *rec, int advance) {
+  /* FREE WHAT WAS RETIRED TWO EPOCHS AGO AND IS IN NO HAZARD SLOT */
+  unsigned long epoch;
+  limbo_t **link = &rec->limbo, *item;
+  size_t held;
+
+  if (advance)
+    try_advance();
+  epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  rec->reclaimed = epoch;
+  rec->exits = 0;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  for (item = rec->limbo; item != NULL && item->epoch + 2 > epoch; item = item->next)
+    ;
+  if (item == NULL)
+    return;
+  held = snapshot_hazards(rec);
+
+  while ((item = *link) != NULL) {
+    if (item->epoch + 2 <= epoch &&
+        bsearch(&item->ptr, rec->held, held, sizeof(void *), compare_ptrs) == NULL) {
+      *link = item->next;
+      item->destroy(item->ptr);
+      free(item);
+      rec->limbo_count--;
+    }
+    else
+      link = &item->next;
+  }
+}
+
+void epoch_exit(void) {
+  record_t *rec = my_record;
+
+  __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+
+  /*
+   * A THREAD THAT STOPS RETIRING STILL FREES WHAT IT LEFT BEHIND: ONCE
+   * THE EPOCH HAS MOVED, AND EVERY RECLAIM_EVERY EXITS IT TRIES TO MOVE
+   * IT ITSELF. IN BETWEEN IT ONLY READS global_epoch, SO A READER WHOSE
+   * LIMBO IS HELD BY A HAZARD SLOT STILL WRITES NO SHARED LINE.
+   */
+  if (rec->limbo_count == 0)
+    return;
+  if (__atomic_load_n(&global_epoch, __ATOMIC_RELAXED) != rec->reclaimed)
+    reclaim(rec, 0);
+  else if (++rec->exits == RECLAIM_EVERY)
+    reclaim(rec, 1);
+}
+
+void epoch_retire(void *ptr, void (*destroy)(void *)) {
+  record_t *rec = get_record();
+  limbo_t *item = malloc(sizeof(limbo_t));
+
+  if (item == NULL)
+    abort();
+  item->ptr = ptr;
+  item->destroy = destroy;
+  item->epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  item->next = rec->limbo;
+  rec->limbo = item;
+
+  if (++rec->limbo_count % RECLAIM_EVERY == 0)
+    reclaim(rec, 1);
+}
+
+hazard_t *hazard_acquire(void) {
+  record_t *rec = get_record();
+  hazard_t *hz;
+
+  /* REUSE ONE THIS THREAD RELEASED, OR PUSH A NEW ONE */
+  if ((hz = rec->spare) == NULL)
+    return new_hazard();
+  rec->spare = hz->spare;
+  hz->spare = NULL;
+  return hz;
+}
+
+void hazard_release(hazard_t *hz) {
+  record_t *rec = get_record();
+
+  hazard_clear(hz);
+  hz->spare = rec->spare;
+  rec->spare = hz;
+}
+
+hazard_t *thread_hazard(void) {
+  return get_record()->hazard;
+}
+
+void hazard_set(hazard_t *hz, void *ptr) {
+  /* ONLY INSIDE AN EPOCH, SO ptr CANNOT HAVE BEEN FREED YET */
+  __atomic_store_n(&hz->ptr, ptr, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void hazard_clear(hazard_t *hz) {
+  __atomic_store_n(&hz->ptr, NULL, __ATOMIC_RELEASE);
+}
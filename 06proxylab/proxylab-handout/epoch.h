@@ -0,0 +1,44 @@
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#define CACHE_LINE   64
+
+/*
+ * EPOCH BASED RECLAMATION WITH HAZARD POINTERS
+ *
+ * READERS WALK SHARED STRUCTURES BETWEEN epoch_enter AND epoch_exit
+ * WITHOUT LOCKS. WRITERS UNLINK A NODE AND HAND IT TO epoch_retire,
+ * WHICH FREES IT ONLY AFTER EVERY READER THAT COULD HAVE SEEN IT HAS
+ * LEFT ITS CRITICAL SECTION. A READER THAT NEEDS A NODE FOR LONGER
+ * (LIKE A CACHE OBJECT WHILE IT IS WRITTEN TO A SLOW CLIENT) PUTS IT IN
+ * A HAZARD SLOT BEFORE LEAVING, AND THE NODE IS KEPT UNTIL THE SLOT IS
+ * CLEARED. BOTH ONLY WRITE THE READER'S OWN CACHE LINE.
+ *
+ * A RELEASED SLOT GOES ON ITS THREAD'S FREE LIST AND THE NEXT ACQUIRE
+ * ON THAT THREAD TAKES IT BACK, SO THERE ARE ONLY AS MANY SLOTS AS NODES
+ * EVER HELD AT ONCE, AND BOTH CALLS ARE O(1). hazard_release MUST RUN ON
+ * THE THREAD THAT ACQUIRED THE SLOT. A RECLAIM SORTS THE SLOTS ONCE AND
+ * LOOKS UP EACH OLD NODE IN THAT SNAPSHOT, SO A NODE MUST NOT BE COPIED
+ * FROM ONE SLOT TO ANOTHER: THE SNAPSHOT COULD MISS IT IN BOTH.
+ */
+
+typedef struct hazard {
+  void *ptr;                    /* PROTECTED NODE, OR NULL */
+  struct hazard *spare;         /* NEXT FREE SLOT OF THE SAME THREAD */
+  struct hazard *next;          /* ALL SLOTS EVER MADE, NEVER FREED */
+} __attribute__((aligned(CACHE_LINE))) hazard_t;
+
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *ptr, void (*destroy)(void *));
+
+hazard_t *hazard_acquire(void);
+void hazard_release(hazard_t *hz);
+hazard_t *thread_hazard(void);
+void hazard_set(hazard_t *hz, void *ptr);
+void hazard_clear(hazard_t *hz);
+
+#endif /* __EPOCH_H__ */
@@ -0,0 +1,525 @@
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "event.h"
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE 0
+#endif
+
+#define MAX_EVENTS  256
+#define MIN_COPY    4096
+
+typedef struct {
+  int epoll_fd;
+  int listen_fd;
+  int listen_events;            /* HOW THE LISTEN SOCKET IS WATCHED */
+  long paused_until;            /* MS, 0 WHILE THE LISTEN SOCKET IS WATCHED */
+  time_t reported;              /* LAST accept error MESSAGE */
+  cache_t *cache;
+  dns_t *dns;
+  dns_inbox_t inbox;            /* ANSWERS TO THIS LOOP'S CACHE MISSES */
+} loop_t;
+
+/*
+ * ONLY ONE END OF A CONNECTION IS IN THE EPOLL SET AT A TIME, SO A BATCH
+ * FROM epoll_wait NEVER HOLDS A SECOND EVENT FOR A CONNECTION THAT AN
+ * EARLIER ONE IN THE SAME BATCH CLOSED.
+ */
+
+static void set_nonblock(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    unix_error("fcntl error");
+}
+
+static int watch(loop_t *loop, conn_end_t *end, int events) {
+  /* ADD, CHANGE OR DROP end SO EPOLL REPORTS EXACTLY events */
+  struct epoll_event ev;
+  int op;
+
+  if (end->events == events)
+    return 0;
+  if (events == 0)
+    op = EPOLL_CTL_DEL;
+  else if (end->events == 0)
+    op = EPOLL_CTL_ADD;
+  else
+    op = EPOLL_CTL_MOD;
+
+  ev.events = events;
+  ev.data.ptr = end;
+  if (epoll_ctl(loop->epoll_fd, op, end->fd, &ev) < 0)
+    return -1;
+  end->events = events;
+  return 0;
+}
+
+static int would_block(void) {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+static long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static void watch_listen(loop_t *loop, int on) {
+  /* THE LISTEN SOCKET IS NOT A conn_end_t, ITS EVENT CARRIES A NULL PTR */
+  struct epoll_event ev;
+
+  ev.events = loop->listen_events;
+  ev.data.ptr = NULL;
+  if (epoll_ctl(loop->epoll_fd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, loop->listen_fd, &ev) < 0)
+    unix_error("epoll_ctl error");
+}
+
+static void close_conn(conn_t *conn) {
+  /* CLOSING THE FDS ALSO TAKES THEM OUT OF THE EPOLL SET */
+  if (conn->client.fd >= 0)
+    close(conn->client.fd);
+  if (conn->server.fd >= 0)
+    close(conn->server.fd);
+  if (conn->hazard != NULL)
+    hazard_release(conn->hazard);
+  if (conn->request_line != NULL) {
+    free(conn->request_line->url);
+    free(conn->request_line);
+  }
+  free(conn->copy.data);
+  free(conn);
+}
+
+static void accept_conns(loop_t *loop) {
+  conn_t *conn;
+  int fd, err;
+
+  while (1) {
+    if ((fd = accept(loop->listen_fd, NULL, NULL)) < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (would_block())
+        return;
+      err = errno;
+      if (time(NULL) != loop->reported) {
+        loop->reported = time(NULL);
+        printf("accept error: %s\n", strerror(err));
+      }
+      if (err == EMFILE || err == ENFILE) {
+        /* THE BACKLOG STAYS READABLE, SO WAIT FOR CONNECTIONS TO CLOSE */
+        watch_listen(loop, 0);
+        loop->paused_until = now_ms() + ACCEPT_BACKOFF_MS;
+      }
+      return;
+    }
+
+    /* LINUX DOES NOT PASS O_NONBLOCK ON FROM THE LISTEN SOCKET */
+    set_nonblock(fd);
+    if ((conn = calloc(1, sizeof(conn_t))) == NULL) {
+      close(fd);
+      continue;
+    }
+    conn->state = CONN_READ_REQUEST;
+    conn->client.fd = fd;
+    conn->client.conn = conn;
+    conn->server.fd = -1;
+    conn->server.conn = conn;
+
+    if (watch(loop, &conn->client, EPOLLIN) < 0)
+      close_conn(conn);
+  }
+}
+
+static int write_cache(loop_t *loop, conn_t *conn) {
+  ssize_t n;
+
+  while (conn->off < conn->hit->data_size) {
+    if ((n = write(conn->client.fd, conn->hit->data + conn->off, conn->hit->data_size - conn->off)) < 0) {
+      if (would_block())
+        return watch(loop, &conn->client, EPOLLOUT);
+      return -1;
+    }
+    conn->off += n;
+  }
+
+  /* DONE */
+  return -1;
+}
+
+static int connect_next(loop_t *loop, conn_t *conn) {
+  /* START A NON-BLOCKING CONNECT TO THE NEXT ADDRESS, -1 WHEN NONE ARE LEFT */
+  dns_addr_t *addr;
+  int fd;
+
+  while (conn->addr_next < conn->addr_count) {
+    addr = &conn->addrs[conn->addr_next++];
+    if ((fd = socket(addr->family, addr->socktype | SOCK_NONBLOCK, addr->protocol)) < 0)
+      continue;
+    if (connect(fd, (struct sockaddr *)&addr->addr, addr->addrlen) == 0 || errno == EINPROGRESS) {
+      conn->server.fd = fd;
+      conn->server.events = 0;
+      return watch(loop, &conn->server, EPOLLOUT);
+    }
+    close(fd);
+  }
+  return -1;
+}
+
+static int bad_gateway(conn_t *conn) {
+  /* A FEW BYTES TO A CLIENT WE HAVE NOT WRITTEN TO YET, ONE TRY WILL DO */
+  send_error(conn->client.fd, "502 Bad Gateway", 0);
+  return -1;
+}
+
+static int server_found(loop_t *loop, conn_t *conn, int count) {
+  /* count ADDRESSES ARE IN conn->addrs, OR count IS A getaddrinfo ERROR */
+  url_t *url = conn->request_line->url;
+
+  if (count < 0) {
+    printf("getaddrinfo failed (%s:%s): %s\n", url->hostname, url->port, gai_strerror(count));
+    return bad_gateway(conn);
+  }
+  conn->addr_count = count;
+  conn->addr_next = 0;
+
+  if (connect_next(loop, conn) < 0)
+    return bad_gateway(conn);
+  return 0;
+}
+
+dns_query_t *new_query(url_t *url, void *owner) {
+  dns_query_t *query;
+
+  if ((query = calloc(1, sizeof(dns_query_t))) == NULL)
+    return NULL;
+  strncpy(query->host, url->hostname, MAX_HOST_LEN - 1);
+  strncpy(query->port, url->port, MAX_PORT_LEN - 1);
+  query->owner = owner;
+  return query;
+}
+
+static int open_server(loop_t *loop, conn_t *conn) {
+  /* START CONNECTING, OR WAIT WITH NOTHING WATCHED WHILE A RESOLVER THREAD LOOKS THE NAME UP */
+  url_t *url = conn->request_line->url;
+  dns_query_t *query;
+  int count;
+
+  if (dns_cached(loop->dns, url->hostname, url->port, conn->addrs, DNS_MAX_ADDRS, &count))
+    return server_found(loop, conn, count);
+  if ((query = new_query(url, conn)) == NULL)
+    return bad_gateway(conn);
+  dns_submit(loop->dns, &loop->inbox, query);
+  return 0;
+}
+
+static void resolved(loop_t *loop) {
+  /* PICK UP THE LOOKUPS THE RESOLVER THREADS FINISHED */
+  dns_query_t *query, *next;
+  conn_t *conn;
+  uint64_t count;
+
+  if (read(loop->inbox.fd, &count, sizeof(count)) < 0 && !would_block())
+    unix_error("eventfd read error");
+  for (query = dns_take(&loop->inbox); query != NULL; query = next) {
+    next = query->next;
+    conn = query->owner;
+    memcpy(conn->addrs, query->addrs, sizeof(conn->addrs));
+    if (server_found(loop, conn, query->result) < 0)
+      close_conn(conn);
+    free(query);
+  }
+}
+
+cache_obj_t *hold_hit(cache_t *cache, url_t *url, hazard_t **hazard) {
+  /* A HIT GOES STRAIGHT INTO A SLOT OF ITS OWN IN *hazard, NEVER HANDED
+     FROM ONE SLOT TO ANOTHER WHERE A RECLAIM COULD SEE NEITHER */
+  hazard_t *hz = hazard_acquire();
+  cache_obj_t *hit;
+
+  if ((hit = find_cache(cache, url->hostname, url->port, url->uri, hz)) != NULL)
+    *hazard = hz;
+  else
+    hazard_release(hz);
+  return hit;
+}
+
+int rewrite_request(request_line_t *request_line, char *buf, size_t *len) {
+  /* TURN THE CLIENT REQUEST IN buf INTO THE SERVER REQUEST, IN PLACE */
+  char request[MAX_STR_LEN];
+  char *line, *end, saved;
+  size_t line_len, request_len;
+
+  request_len = server_request(request_line, request, 0);
+  line = strstr(buf, "\r\n") + 2;
+  while ((end = strstr(line, "\r\n")) != NULL) {
+    line_len = end + 2 - line;
+    saved = end[2];
+    end[2] = '\0';
+    if (forward_header(line)) {
+      if (request_len + line_len >= MAX_STR_LEN)
+        return -1;
+      memcpy(request + request_len, line, line_len);
+      request_len += line_len;
+    }
+    end[2] = saved;
+    if (line_len == 2)
+      break;
+    line = end + 2;
+  }
+  memcpy(buf, request, request_len);
+  *len = request_len;
+  return 0;
+}
+
+static int start_request(loop_t *loop, conn_t *conn) {
+  url_t *url;
+
+  conn->request_line = parse_request_line(conn->buf);
+  url = conn->request_line->url;
+  if (strcmp(conn->request_line->method, "GET")) {
+    printf("This proxy only accepts GET method!\n");
+    return -1;
+  }
+
+  /* CHECK CACHE */
+  if ((conn->hit = hold_hit(loop->cache, url, &conn->hazard)) != NULL) {
+    conn->state = CONN_WRITE_CACHE;
+    conn->off = 0;
+    return write_cache(loop, conn);
+  }
+
+  if (rewrite_request(conn->request_line, conn->buf, &conn->len) < 0)
+    return -1;
+  conn->off = 0;
+
+  /* CONNECT, THE CLIENT IS LEFT ALONE UNTIL THE RESPONSE ARRIVES */
+  conn->state = CONN_CONNECTING;
+  if (watch(loop, &conn->client, 0) < 0)
+    return -1;
+  return open_server(loop, conn);
+}
+
+static int read_request(loop_t *loop, conn_t *conn) {
+  ssize_t n;
+
+  if ((n = read(conn->client.fd, conn->buf + conn->len, MAX_STR_LEN - 1 - conn->len)) < 0)
+    return would_block() ? 0 : -1;
+  if (n == 0)
+    return -1;
+
+  conn->len += n;
+  conn->buf[conn->len] = '\0';
+  if (strstr(conn->buf, "\r\n\r\n") == NULL)
+    return conn->len < MAX_STR_LEN - 1 ? 0 : -1;
+
+  return start_request(loop, conn);
+}
+
+static int send_request(loop_t *loop, conn_t *conn) {
+  ssize_t n;
+
+  while (conn->off < conn->len) {
+    if ((n = write(conn->server.fd, conn->buf + conn->off, conn->len - conn->off)) < 0)
+      return would_block() ? 0 : -1;
+    conn->off += n;
+  }
+
+  conn->len = 0;
+  conn->off = 0;
+  conn->state = CONN_RELAY;
+  return watch(loop, &conn->server, EPOLLIN);
+}
+
+static int connected(loop_t *loop, conn_t *conn) {
+  int err = 0;
+  socklen_t err_len = sizeof(err);
+
+  if (getsockopt(conn->server.fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0) {
+    /* THAT ADDRESS IS UNREACHABLE, TRY THE NEXT ONE */
+    close(conn->server.fd);
+    conn->server.fd = -1;
+    if (connect_next(loop, conn) == 0)
+      return 0;
+    printf("connect failed (%s:%s): %s\n", conn->request_line->url->hostname, conn->request_line->url->port, strerror(err));
+    return bad_gateway(conn);
+  }
+
+  conn->state = CONN_SEND_REQUEST;
+  return send_request(loop, conn);
+}
+
+static int relay_write(loop_t *loop, conn_t *conn) {
+  ssize_t n;
+
+  while (conn->off < conn->len) {
+    if ((n = write(conn->client.fd, conn->buf + conn->off, conn->len - conn->off)) < 0) {
+      if (!would_block())
+        return -1;
+      /* CLIENT IS SLOW, STOP READING THE SERVER UNTIL IT CATCHES UP */
+      if (watch(loop, &conn->server, 0) < 0)
+        return -1;
+      return watch(loop, &conn->client, EPOLLOUT);
+    }
+    conn->off += n;
+  }
+
+  conn->len = 0;
+  conn->off = 0;
+  if (watch(loop, &conn->client, 0) < 0)
+    return -1;
+  return watch(loop, &conn->server, EPOLLIN);
+}
+
+void copy_append(cache_t *cache, response_copy_t *copy, char *buf, size_t n) {
+  /* SAME RULE AS request_handler, GROWING THE COPY AS THE RESPONSE DOES */
+  size_t cap;
+  char *data;
+
+  if (copy->len + n < cache->max_obj_size) {
+    if (copy->len + n > copy->cap) {
+      cap = copy->cap ? copy->cap : MIN_COPY;
+      while (cap < copy->len + n)
+        cap *= 2;
+      if (cap > cache->max_obj_size)
+        cap = cache->max_obj_size;
+      if ((data = realloc(copy->data, cap)) == NULL) {
+        /* GIVE UP ON CACHING THIS ONE */
+        copy->len = cache->max_obj_size;
+        return;
+      }
+      copy->data = data;
+      copy->cap = cap;
+    }
+    memcpy(copy->data + copy->len, buf, n);
+  }
+  copy->len += n;
+}
+
+void copy_push(cache_t *cache, url_t *url, response_copy_t *copy) {
+  /* SERVER IS DONE, PUSH CACHE IF THE WHOLE RESPONSE FIT */
+  cache_obj_t *obj;
+
+  if (copy->len < cache->max_obj_size) {
+    obj = new_object(url->hostname, url->port, url->uri, "", copy->data ? copy->data : "", copy->len);
+    if (push_front(cache, obj) != 0)
+      free_object(obj);
+  }
+}
+
+static int relay_read(loop_t *loop, conn_t *conn) {
+  ssize_t n;
+
+  if ((n = read(conn->server.fd, conn->buf, MAX_STR_LEN)) < 0)
+    return would_block() ? 0 : -1;
+  if (n == 0) {
+    copy_push(loop->cache, conn->request_line->url, &conn->copy);
+    return -1;
+  }
+
+  copy_append(loop->cache, &conn->copy, conn->buf, n);
+  conn->len = n;
+  conn->off = 0;
+  return relay_write(loop, conn);
+}
+
+static int handle(loop_t *loop, conn_end_t *end) {
+  conn_t *conn = end->conn;
+
+  switch (conn->state) {
+  case CONN_READ_REQUEST:
+    return read_request(loop, conn);
+  case CONN_CONNECTING:
+    return connected(loop, conn);
+  case CONN_SEND_REQUEST:
+    return send_request(loop, conn);
+  case CONN_RELAY:
+    return end == &conn->server ? relay_read(loop, conn) : relay_write(loop, conn);
+  case CONN_WRITE_CACHE:
+    return write_cache(loop, conn);
+  }
+  return -1;
+}
+
+static void *loop_thread(void *vargp) {
+  loop_t *loop = vargp;
+  struct epoll_event events[MAX_EVENTS];
+  conn_end_t *end;
+  long timeout;
+  int i, n;
+
+  while (1) {
+    /* A PAUSED LOOP WAKES UP TO WATCH THE LISTEN SOCKET AGAIN */
+    timeout = -1;
+    if (loop->paused_until != 0) {
+      if ((timeout = loop->paused_until - now_ms()) <= 0) {
+        loop->paused_until = 0;
+        watch_listen(loop, 1);
+        timeout = -1;
+      }
+    }
+    if ((n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout)) < 0) {
+      if (errno == EINTR)
+        continue;
+      unix_error("epoll_wait error");
+    }
+
+    for (i = 0; i < n; i++) {
+      if ((end = events[i].data.ptr) == NULL)
+        accept_conns(loop);
+      else if (events[i].data.ptr == &loop->inbox)
+        resolved(loop);
+      else if (handle(loop, end) < 0)
+        close_conn(end->conn);
+    }
+  }
+
+  return NULL;
+}
+
+void event_run(int listen_fd, cache_t *cache, dns_t *dns, int loops) {
+  /* RUN loops EVENT LOOPS (0 FOR ONE PER CPU), NEVER RETURNS */
+  struct epoll_event ev;
+  struct rlimit limit;
+  loop_t *loop;
+  pthread_t tid;
+  int i;
+
+  /* ONE FD PER CLIENT AND ONE PER SERVER, TAKE ALL WE MAY */
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  if (loops <= 0 && (loops = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+    loops = 1;
+  set_nonblock(listen_fd);
+
+  for (i = 0; i < loops; i++) {
+    if ((loop = malloc(sizeof(loop_t))) == NULL)
+      unix_error("malloc error");
+    if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+      unix_error("epoll_create1 error");
+    loop->listen_fd = listen_fd;
+    loop->paused_until = 0;
+    loop->reported = 0;
+    loop->cache = cache;
+    loop->dns = dns;
+
+    /* WAKE ONE LOOP PER NEW CONNECTION, NOT ALL OF THEM */
+    loop->listen_events = EPOLLIN | (loops > 1 ? EPOLLEXCLUSIVE : 0);
+    watch_listen(loop, 1);
+
+    dns_inbox_init(dns, &loop->inbox);
+    set_nonblock(loop->inbox.fd);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &loop->inbox;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->inbox.fd, &ev) < 0)
+      unix_error("epoll_ctl error");
+
+    if (i == loops - 1)
+      loop_thread(loop);
+    Pthread_create(&tid, NULL, loop_thread, loop);
+  }
+}
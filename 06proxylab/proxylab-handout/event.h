@@ -0,0 +1,74 @@
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include "handler.h"
+
+/*
+ * EPOLL MODE
+ *
+ * EACH LOOP IS ONE THREAD WITH ITS OWN EPOLL SET. ALL LOOPS WATCH THE
+ * SAME NON-BLOCKING LISTEN SOCKET (EPOLLEXCLUSIVE WAKES ONLY ONE OF THEM)
+ * AND KEEP THE CONNECTIONS THEY ACCEPT. A CONNECTION IS A SMALL STATE
+ * MACHINE DRIVEN BY READINESS ON ITS CLIENT AND SERVER SOCKETS, SO NO
+ * THREAD EVER BLOCKS ON ONE SLOW PEER. NAMES MISSING FROM THE RESOLVER
+ * CACHE ARE LOOKED UP BY THE RESOLVER THREADS (SEE dns.h), AND THE
+ * ANSWER COMES BACK THROUGH THE LOOP'S INBOX.
+ */
+
+/* OUT OF FDS, STOP ACCEPTING THIS LONG SO THE LOOP DOES NOT SPIN ON THE LISTEN SOCKET */
+#define ACCEPT_BACKOFF_MS  100
+
+typedef enum {
+  CONN_READ_REQUEST,            /* READING REQUEST LINE AND HEADERS */
+  CONN_CONNECTING,              /* RESOLVING, THEN WAITING FOR THE SERVER TO ACCEPT */
+  CONN_SEND_REQUEST,            /* WRITING THE REQUEST TO THE SERVER */
+  CONN_RELAY,                   /* SERVER RESPONSE TO CLIENT */
+  CONN_WRITE_CACHE              /* CACHED OBJECT TO CLIENT */
+} conn_state_t;
+
+/* RESPONSE COPY FOR THE CACHE, GIVEN UP ONCE len REACHES max_obj_size */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} response_copy_t;
+
+struct conn;
+
+typedef struct {
+  int fd;
+  int events;                   /* WHAT EPOLL WATCHES FOR, 0 IF NOT IN THE SET */
+  struct conn *conn;
+} conn_end_t;
+
+typedef struct conn {
+  conn_state_t state;
+  conn_end_t client;
+  conn_end_t server;
+  request_line_t *request_line;
+
+  /* REQUEST, THEN UPSTREAM REQUEST, THEN RESPONSE CHUNKS */
+  char buf[MAX_STR_LEN];
+  size_t len;
+  size_t off;
+
+  /* SERVER ADDRESSES, TRIED IN TURN UNTIL ONE ACCEPTS */
+  dns_addr_t addrs[DNS_MAX_ADDRS];
+  int addr_count;
+  int addr_next;
+
+  /* CACHE HIT BEING WRITTEN, KEPT ALIVE BY hazard */
+  cache_obj_t *hit;
+  hazard_t *hazard;
+
+  response_copy_t copy;
+} conn_t;
+
+cache_obj_t *hold_hit(cache_t *cache, url_t *url, hazard_t **hazard);
+dns_query_t *new_query(url_t *url, void *owner);
+int rewrite_request(request_line_t *request_line, char *buf, size_t *len);
+void copy_append(cache_t *cache, response_copy_t *copy, char *buf, size_t n);
+void copy_push(cache_t *cache, url_t *url, response_copy_t *copy);
+void event_run(int listen_fd, cache_t *cache, dns_t *dns, int loops);
+
+#endif /* __EVENT_H__ */
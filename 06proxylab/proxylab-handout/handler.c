@@ -1,5 +1,18 @@
+#include <sys/syscall.h>
 #include "handler.h"
 
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE  1
+#define SPLICE_F_MORE  4
+#endif
+
+/* BYTES PER SPLICE, THE DEFAULT PIPE CAPACITY */
+#define SPLICE_LEN     65536
+
+/* EACH WORKER KEEPS ONE EMPTY PIPE FOR SPLICING, OR GIVES UP ON IT */
+static __thread int relay_pipe[2] = { -1, -1 };
+static __thread int no_splice = 0;
+
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
 
 url_t *parse_url(char* url) {
@@ -75,110 +88,498 @@ request_line_t *parse_request_line(char* request) {
   return result;
 }
 
-void request_handler(void *vargv) {
-  /* PARSE ARGS */
-  req_thread_arg_t *req_args = (req_thread_arg_t *)vargv;
-  int client_fd = req_args->client_fd;
-  cache_t *cache = req_args->global_cache;
+int server_request(request_line_t *request_line, char *buf, int keep_alive) {
+  /* REQUEST LINE AND THE HEADERS THE PROXY ALWAYS SENDS */
+  if (keep_alive)
+    return sprintf(
+      buf,
+      "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n%s",
+      request_line->url->uri, request_line->url->hostname, user_agent_hdr
+    );
+  return sprintf(
+    buf,
+    "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\nProxy-Connection: close\r\n%s",
+    request_line->url->uri, request_line->url->hostname, user_agent_hdr
+  );
+}
 
-  char temp_buf[MAX_STR_LEN];
-  char client_buf[MAX_STR_LEN];
-  request_line_t *request_line;
+int forward_header(char *line) {
+  /* CLIENT HEADERS EXCEPT THE ONES server_request REPLACES */
+  char name[MAX_STR_LEN];
 
-  /* READ REQUEST*/
-  size_t read_num;
-  rio_t client_rio;
-  Rio_readinitb(&client_rio, client_fd);
+  if (sscanf(line, "%[^:]:", name) != 1)
+    return 1;
+  return strcmp(name, "Host") &&
+    strcmp(name, "Connection") &&
+    strcmp(name, "Proxy-Connection") &&
+    strcmp(name, "User-Agent");
+}
+
+static int header_is(char *line, char *name) {
+  /* HEADER NAMES ARE CASE INSENSITIVE */
+  size_t len = strlen(name);
+
+  return !strncasecmp(line, name, len) && line[len] == ':';
+}
+
+static int has_token(char *line, char *token) {
+  /* A CONNECTION HEADER LISTING token, IN ANY CASE */
+  size_t len = strlen(token);
+  char *p;
+
+  for (p = strchr(line, ':'); p != NULL && *p != '\0'; p++)
+    if (!strncasecmp(p, token, len))
+      return 1;
+  return 0;
+}
 
-  if ((read_num = Rio_readlineb(&client_rio, client_buf, MAX_STR_LEN)) == 0) {
-    printf("Not readable request!\n");
-    return;
+static int send_all(int fd, char *buf, size_t n) {
+  /* NO EXIT ON A CLIENT THAT WENT AWAY, UNLIKE Rio_writen */
+  return rio_writen(fd, buf, n) == (ssize_t)n;
+}
+
+int send_error(int fd, char *status, int keep_alive) {
+  char buf[MAX_STR_LEN];
+  int len = sprintf(
+    buf,
+    "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %d\r\nConnection: %s\r\n\r\n%s\n",
+    status, (int)strlen(status) + 1, keep_alive ? "keep-alive" : "close", status
+  );
+
+  return send_all(fd, buf, len);
+}
+
+static size_t head_length(char *data, size_t size) {
+  /* BYTES UP TO AND WITH THE BLANK LINE ENDING THE HEAD, 0 IF THERE IS NONE */
+  size_t i;
+
+  for (i = 0; i + 1 < size && i + 3 < MAX_STR_LEN; i++) {
+    if (data[i] != '\n')
+      continue;
+    if (data[i + 1] == '\n')
+      return i + 2;
+    if (data[i + 1] == '\r' && i + 2 < size && data[i + 2] == '\n')
+      return i + 3;
   }
+  return 0;
+}
+
+static size_t format_head(char *buf, char *head, long body_len, int http11, int chunked, char *connection) {
+  /*
+   * A RESPONSE HEAD WITH OUR OWN FRAMING: THE STATUS LINE AND END-TO-END
+   * HEADERS AS THE SERVER SENT THEM, THEN Content-Length OR CHUNKED, THEN
+   * connection UNLESS IT IS NULL. buf HOLDS MAX_STR_LEN + 128
+   */
+  char *line = head, *end;
+  size_t len = 0, line_len;
+
+  while ((end = strchr(line, '\n')) != NULL) {
+    line_len = end + 1 - line;
+    if (line[0] == '\r' || line[0] == '\n')
+      break;
+
+    if (line == head && http11 && !strncmp(line, "HTTP/", 5) && strchr(line, ' ') != NULL) {
+      /* WE SPEAK 1.1 TO THIS CLIENT, WHATEVER THE SERVER SPOKE TO US */
+      len += sprintf(buf + len, "HTTP/1.1");
+      line_len -= strchr(line, ' ') - line;
+      line = strchr(line, ' ');
+    }
+    if (!header_is(line, "Connection") &&
+        !header_is(line, "Proxy-Connection") &&
+        !header_is(line, "Keep-Alive") &&
+        !header_is(line, "Transfer-Encoding") &&
+        !header_is(line, "Content-Length")) {
+      memcpy(buf + len, line, line_len);
+      len += line_len;
+    }
+    line = end + 1;
+  }
+
+  if (body_len >= 0)
+    len += sprintf(buf + len, "Content-Length: %ld\r\n", body_len);
+  else if (chunked)
+    len += sprintf(buf + len, "Transfer-Encoding: chunked\r\n");
+  if (connection != NULL)
+    len += sprintf(buf + len, "Connection: %s\r\n", connection);
+  len += sprintf(buf + len, "\r\n");
+
+  return len;
+}
+
+static int send_head(int fd, char *head, long body_len, int http11, int keep_alive, int chunked) {
+  char buf[MAX_STR_LEN + 128];
+
+  return send_all(fd, buf, format_head(buf, head, body_len, http11, chunked, keep_alive ? "keep-alive" : "close"));
+}
+
+static void parse_head(char *head, response_info_t *info) {
+  /* HOW THE BODY AFTER head IS FRAMED, AND IF THE CONNECTION MAY BE REUSED */
+  char *line;
+
+  info->status = 0;
+  info->body_len = -1;
+  info->chunked = 0;
+  info->reusable = !strncmp(head, "HTTP/1.1", 8);
+  sscanf(head, "%*s %d", &info->status);
+
+  for (line = strchr(head, '\n'); line != NULL; line = strchr(line, '\n')) {
+    line++;
+    if (header_is(line, "Content-Length"))
+      info->body_len = strtol(strchr(line, ':') + 1, NULL, 10);
+    else if (header_is(line, "Transfer-Encoding") && has_token(line, "chunked"))
+      info->chunked = 1;
+    else if (header_is(line, "Connection")) {
+      if (has_token(line, "close"))
+        info->reusable = 0;
+      else if (has_token(line, "keep-alive"))
+        info->reusable = 1;
+    }
+  }
+
+  /* CHUNKED WINS OVER A LENGTH, AND SOME ANSWERS NEVER HAVE A BODY */
+  if (info->chunked)
+    info->body_len = -1;
+  if ((info->status >= 100 && info->status < 200) || info->status == 204 || info->status == 304) {
+    info->body_len = 0;
+    info->chunked = 0;
+  }
+  /* A BODY THAT ENDS WITH THE CONNECTION ENDS ITS REUSE TOO */
+  if (!info->chunked && info->body_len < 0)
+    info->reusable = 0;
+}
+
+static int send_cached(int fd, cache_obj_t *obj, int http11, int keep_alive) {
+  /* A CACHED RESPONSE IS A HEAD AND THE WHOLE BODY, REFRAME IT FOR THIS CLIENT */
+  char head[MAX_STR_LEN];
+  size_t head_len = head_length(obj->data, obj->data_size);
+
+  /* NO HEAD TO REFRAME, SEND IT RAW AND END THE CONNECTION */
+  if (head_len == 0) {
+    send_all(fd, obj->data, obj->data_size);
+    return 0;
+  }
+
+  memcpy(head, obj->data, head_len);
+  head[head_len] = '\0';
+  return send_head(fd, head, obj->data_size - head_len, http11, keep_alive, 0) &&
+    send_all(fd, obj->data + head_len, obj->data_size - head_len);
+}
+
+static int send_chunk(int fd, char *buf, size_t n, int chunked) {
+  char size[32];
+
+  if (!chunked)
+    return send_all(fd, buf, n);
+  return send_all(fd, size, sprintf(size, "%zx\r\n", n)) &&
+    send_all(fd, buf, n) &&
+    send_all(fd, "\r\n", 2);
+}
+
+static size_t read_head(rio_t *rio, char *head) {
+  /* RESPONSE HEAD UP TO AND WITH THE BLANK LINE, NUL TERMINATED, ITS LENGTH OR 0 */
+  size_t len = 0;
+  ssize_t n;
+
+  while ((n = rio_readlineb(rio, head + len, MAX_STR_LEN - len)) > 0) {
+    if (head[len + n - 1] != '\n')
+      return 0;
+    if (len > 0 && (!strcmp(head + len, "\r\n") || !strcmp(head + len, "\n")))
+      return len + n;
+    len += n;
+  }
+  return 0;
+}
+
+static void sink_write(body_sink_t *sink, char *buf, size_t n) {
+  /* TO THE CLIENT, AND TO THE CACHE COPY WHILE IT STILL FITS */
+  if (sink->len + n < sink->max)
+    memcpy(sink->data + sink->len, buf, n);
+  sink->len += n;
+  sink->ok = send_chunk(sink->fd, buf, n, sink->chunked);
+}
+
+static ssize_t splice_fd(int from, int to, size_t len) {
+  /* NO _GNU_SOURCE HERE (IT BREAKS csapp.h), SO NO splice() PROTOTYPE EITHER */
+  ssize_t n;
+
+  while ((n = syscall(__NR_splice, from, NULL, to, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0 && errno == EINTR)
+    ;
+  return n;
+}
+
+static void drop_pipe(void) {
+  /* WHATEVER IS LEFT IN IT BELONGS TO A DEAD RESPONSE */
+  close(relay_pipe[0]);
+  close(relay_pipe[1]);
+  relay_pipe[0] = relay_pipe[1] = -1;
+}
+
+static int splice_body(int fd, long left, body_sink_t *sink) {
+  /* fd TO PIPE TO CLIENT WITHOUT ENTERING USER SPACE, left BYTES OR UP TO EOF
+     IF left < 0. 1 IF IT ALL WENT, 0 IF A PEER FAILED, -1 IF SPLICE CANNOT
+     BE USED (NOTHING IS READ OR SENT THEN) */
+  char size[32];
+  ssize_t in, out;
+  int started = 0;
+
+  if (no_splice || (relay_pipe[0] < 0 && pipe(relay_pipe) < 0))
+    return -1;
+
+  while (left != 0) {
+    if ((in = splice_fd(fd, relay_pipe[1], left < 0 || left > SPLICE_LEN ? SPLICE_LEN : left)) < 0 && !started &&
+        (errno == EINVAL || errno == ENOSYS)) {
+      no_splice = 1;
+      return -1;
+    }
+    if (in <= 0)
+      return in == 0 && left < 0;
+    started = 1;
+
+    /* A RE-CHUNKED BODY GETS ONE CHUNK PER PIPEFUL */
+    if (sink->chunked && !send_all(sink->fd, size, sprintf(size, "%zx\r\n", (size_t)in))) {
+      sink->ok = 0;
+      drop_pipe();
+      return 0;
+    }
+    sink->len += in;
+    if (left > 0)
+      left -= in;
+    for (; in > 0; in -= out) {
+      if ((out = splice_fd(relay_pipe[0], sink->fd, in)) <= 0) {
+        sink->ok = 0;
+        drop_pipe();
+        return 0;
+      }
+    }
+    if (sink->chunked && !send_all(sink->fd, "\r\n", 2)) {
+      sink->ok = 0;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int relay_bytes(rio_t *rio, long left, body_sink_t *sink) {
+  char buf[MAX_STR_LEN];
+  ssize_t n;
+  size_t want;
+  int done;
+
+  while (left > 0 && sink->ok) {
+    want = left > MAX_STR_LEN ? MAX_STR_LEN : left;
+
+    /* TOO BIG TO CACHE: EMPTY THE rio BUFFER, THEN SPLICE THE REST */
+    if (sink->len + left >= sink->max) {
+      if (rio->rio_cnt == 0 && (done = splice_body(rio->rio_fd, left, sink)) >= 0)
+        return done;
+      if (rio->rio_cnt > 0 && rio->rio_cnt < want)
+        want = rio->rio_cnt;
+    }
+
+    if ((n = rio_readnb(rio, buf, want)) <= 0)
+      return 0;
+    sink_write(sink, buf, n);
+    left -= n;
+  }
+  return left == 0;
+}
+
+static int relay_body(rio_t *rio, response_info_t *info, body_sink_t *sink) {
+  /* DECODE THE BODY AS THE SERVER FRAMED IT INTO sink, 1 IF IT WAS ALL THERE */
+  char buf[MAX_STR_LEN];
+  ssize_t n;
+  long left;
+
+  if (info->chunked) {
+    while (sink->ok) {
+      if (rio_readlineb(rio, buf, MAX_STR_LEN) <= 0 || (left = strtol(buf, NULL, 16)) < 0)
+        return 0;
+      if (left == 0) {
+        /* SKIP TRAILERS, UP TO THE BLANK LINE */
+        do {
+          if (rio_readlineb(rio, buf, MAX_STR_LEN) <= 0)
+            return 0;
+        } while (strcmp(buf, "\r\n") && strcmp(buf, "\n"));
+        return 1;
+      }
+      if (!relay_bytes(rio, left, sink) || rio_readlineb(rio, buf, MAX_STR_LEN) <= 0)
+        return 0;
+    }
+    return 0;
+  }
+
+  if (info->body_len >= 0)
+    return relay_bytes(rio, info->body_len, sink);
+
+  /* NO FRAMING, THE BODY ENDS WHEN THE SERVER CLOSES, AND PAST THE CACHE LIMIT IT IS SPLICED */
+  while (sink->ok) {
+    if (sink->len >= sink->max && rio->rio_cnt == 0 && (n = splice_body(rio->rio_fd, -1, sink)) >= 0)
+      return n && sink->ok;
+    if ((n = rio_readnb(rio, buf, sink->len >= sink->max && rio->rio_cnt > 0 ? rio->rio_cnt : MAX_STR_LEN)) <= 0)
+      break;
+    sink_write(sink, buf, n);
+  }
+  return sink->ok && n == 0;
+}
+
+static int take_kept(req_thread_arg_t *args, int *held) {
+  /* A SLOT FOR WAITING ON THIS CLIENT BETWEEN REQUESTS, SO IDLE CLIENTS CANNOT PARK EVERY WORKER */
+  int n = __atomic_load_n(args->kept, __ATOMIC_RELAXED);
+
+  if (*held)
+    return 1;
+  while (n < args->max_kept) {
+    if (__atomic_compare_exchange_n(args->kept, &n, n + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return *held = 1;
+  }
+  return 0;
+}
+
+static int serve_request(rio_t *client_rio, req_thread_arg_t *args, int *held) {
+  /* ONE REQUEST OF A CONNECTION, 1 IF THE NEXT ONE MAY FOLLOW */
+  int client_fd = args->client_fd;
+  cache_t *cache = args->global_cache;
+  pool_t *pool = args->pool;
+  char client_buf[MAX_STR_LEN];
+  char headers[MAX_STR_LEN];
+  size_t headers_len = 0;
+  ssize_t read_num;
+  request_line_t *request_line;
+  int http11, keep_alive, ok;
+
+  /* READ REQUEST, SKIPPING BLANK LINES BETWEEN PIPELINED ONES */
+  do {
+    if ((read_num = rio_readlineb(client_rio, client_buf, MAX_STR_LEN)) <= 0)
+      return 0;
+  } while (!strcmp(client_buf, "\r\n") || !strcmp(client_buf, "\n"));
 
   /* PARSE CLIENT REQUEST LINE */
   request_line = parse_request_line(client_buf);
+  http11 = !strcmp(request_line->version, "HTTP/1.1");
+  keep_alive = http11;
+
+  /* READ ALL HEADERS NOW, SO THE NEXT REQUEST STARTS AT A BOUNDARY */
+  while ((read_num = rio_readlineb(client_rio, client_buf, MAX_STR_LEN)) > 0) {
+    if (!strcmp(client_buf, "\r\n") || !strcmp(client_buf, "\n"))
+      break;
+
+    if (header_is(client_buf, "Connection") || header_is(client_buf, "Proxy-Connection")) {
+      if (has_token(client_buf, "close"))
+        keep_alive = 0;
+      else if (has_token(client_buf, "keep-alive"))
+        keep_alive = 1;
+    }
+    /* A BODY WE DO NOT READ WOULD BE TAKEN FOR THE NEXT REQUEST */
+    if (header_is(client_buf, "Content-Length") || header_is(client_buf, "Transfer-Encoding"))
+      keep_alive = 0;
+
+    if (forward_header(client_buf) && headers_len + read_num < MAX_STR_LEN) {
+      memcpy(headers + headers_len, client_buf, read_num);
+      headers_len += read_num;
+    }
+  }
+  if (read_num <= 0) {
+    free(request_line->url);
+    free(request_line);
+    return 0;
+  }
+  if (keep_alive && !take_kept(args, held))
+    keep_alive = 0;
+
   if (strcmp(request_line->method, "GET")) {
     printf("This proxy only accepts GET method!\n");
+    send_error(client_fd, "501 Not Implemented", 0);
     free(request_line->url);
     free(request_line);
-    return;
+    return 0;
   }
 
   /* CHECK CACHE */
-  P_cache(cache);
   cache_obj_t *hit_obj;
-  if ((hit_obj = find_cache(cache, request_line->url->hostname, request_line->url->uri)) != NULL) {
-    // cache hit! send object
-    Rio_writen(client_fd, hit_obj->data, hit_obj->data_size);
+  hazard_t *hazard = thread_hazard();
+  if ((hit_obj = find_cache(cache, request_line->url->hostname, request_line->url->port, request_line->url->uri, hazard)) != NULL) {
+    // cache hit! send object, the hazard slot keeps it alive
+    ok = send_cached(client_fd, hit_obj, http11, keep_alive);
 
     // before return
-    V_cache(cache);
+    hazard_clear(hazard);
     free(request_line->url);
     free(request_line);
-    
-    return;
+
+    return ok && keep_alive;
   }
-  V_cache(cache);
 
-  /* SEND SERVER REQUEST LINE */
-  int server_fd;
+  /* SEND THE REQUEST, ON A POOLED CONNECTION IF THERE IS ONE */
+  url_t *url = request_line->url;
+  int server_fd, reused;
   rio_t server_rio;
   char server_buf[MAX_STR_LEN];
+  char head[MAX_STR_LEN];
+
+  while ((server_fd = pool_get(pool, url->hostname, url->port, &reused)) >= 0) {
+    Rio_readinitb(&server_rio, server_fd);
+    ok = send_all(server_fd, server_buf, server_request(request_line, server_buf, 1)) &&
+      send_all(server_fd, headers, headers_len) &&
+      send_all(server_fd, "\r\n", 2) &&
+      read_head(&server_rio, head) > 0;
+    if (ok || !reused)
+      break;
+
+    /* THE SERVER CLOSED A POOLED CONNECTION UNDER US, A GET IS SAFE TO RETRY */
+    close(server_fd);
+  }
+  if (server_fd < 0 || !ok) {
+    if (server_fd >= 0)
+      close(server_fd);
+    ok = send_error(client_fd, "502 Bad Gateway", keep_alive);
+    free(request_line->url);
+    free(request_line);
+    return ok && keep_alive;
+  }
 
-  server_fd = Open_clientfd(request_line->url->hostname, request_line->url->port);
-  Rio_readinitb(&server_rio, server_fd);
-
-  sprintf(server_buf, "GET %s HTTP/1.0\r\n", request_line->url->uri);
-  Rio_writen(server_fd, server_buf, strlen(server_buf));
-
-  /* SEND SERVER CUSTOM HEADERS */
-  sprintf(
-    server_buf, 
-    "Host: %s\r\nConnection: close\r\nProxy-Connection: close\r\n%s", 
-    request_line->url->hostname, user_agent_hdr
-  );
-  Rio_writen(server_fd, server_buf, strlen(server_buf));
-
-  /* FORWARD HEADERS */
-  while ((read_num = Rio_readlineb(&client_rio, client_buf, MAX_STR_LEN)) > 0) {
-    sscanf(client_buf, "%[^:]:", temp_buf);
-
-    if (
-      strcmp(temp_buf, "Host") &&
-      strcmp(temp_buf, "Connection") &&
-      strcmp(temp_buf, "Proxy-Connection") &&
-      strcmp(temp_buf, "User-Agent")
-    ) Rio_writen(server_fd, client_buf, strlen(client_buf));
-
-    if (strcmp(client_buf, "\r\n") == 0) break;
+  /* PICK THE FRAMING, AN UNKNOWN LENGTH ENDS THE CONNECTION FOR 1.0 CLIENTS */
+  response_info_t info;
+  int chunked = 0;
+  parse_head(head, &info);
+  if (info.body_len < 0) {
+    if (http11)
+      chunked = 1;
+    else
+      keep_alive = 0;
   }
+  ok = send_head(client_fd, head, info.body_len, http11, keep_alive, chunked);
 
-  /* FORWARD RESPONSE */
-  size_t cache_len = 0;
-  char cache_header[MAX_STR_LEN] = "";
-  char *cache_data = malloc(sizeof(char) * cache->max_obj_size);
+  /* FORWARD BODY, LEAVING ROOM IN FRONT OF THE CACHE COPY FOR ITS HEAD */
+  char *cache_data = malloc(sizeof(char) * (HEAD_ROOM + cache->max_obj_size));
+  body_sink_t sink = { client_fd, chunked, ok, cache_data + HEAD_ROOM, 0, cache->max_obj_size };
+  int complete = relay_body(&server_rio, &info, &sink);
 
-  while ((read_num = Rio_readnb(&server_rio, server_buf, MAX_STR_LEN)) > 0) {
-    if (cache_len + read_num < cache->max_obj_size)
-      memcpy(cache_data + cache_len, server_buf, read_num);
-    Rio_writen(client_fd, server_buf, read_num);
-    cache_len += read_num;
-  }
+  /* A SHORT BODY LEAVES THE CLIENT OUT OF STEP, AND IS NOT WORTH CACHING */
+  ok = sink.ok && complete;
+  if (ok && chunked)
+    ok = send_all(client_fd, "0\r\n\r\n", 5);
 
-  /* PUSH CACHE */
-  if (cache_len < cache->max_obj_size) {
-    P_cache(cache);
+  /* THE SERVER CONNECTION GOES BACK IF IT IS AT A RESPONSE BOUNDARY */
+  if (complete && info.reusable && server_rio.rio_cnt == 0)
+    pool_put(pool, url->hostname, url->port, server_fd);
+  else
+    close(server_fd);
 
+  /* PUSH CACHE, WITH A Content-Length HEAD THAT ANY MODE CAN SEND AS IT IS */
+  char cache_header[MAX_STR_LEN] = "";
+  char cache_head[HEAD_ROOM];
+  size_t cache_head_len = format_head(cache_head, head, sink.len, 0, 0, NULL);
+  if (ok && cache_head_len + sink.len < cache->max_obj_size) {
+    memcpy(cache_data + HEAD_ROOM - cache_head_len, cache_head, cache_head_len);
     cache_obj_t *obj = new_object(
-      request_line->url->hostname,
-      request_line->url->uri,
-      cache_header, cache_data, cache_len
+      url->hostname,
+      url->port,
+      url->uri,
+      cache_header, cache_data + HEAD_ROOM - cache_head_len, cache_head_len + sink.len
     );
 
     if (push_front(cache, obj) != 0)
       free_object(obj);
-
-    V_cache(cache);
   }
 
   /* MEMORY RESTORE */
@@ -186,15 +587,27 @@ void request_handler(void *vargv) {
   free(request_line->url);
   free(request_line);
 
-  return;
+  return ok && keep_alive;
 }
 
-void *request_thread(void *vargv) {
-  /* RUN DETACHED */
-  Pthread_detach(pthread_self());
+void request_handler(void *vargv) {
+  /* PARSE ARGS */
+  req_thread_arg_t *req_args = (req_thread_arg_t *)vargv;
+  int client_fd = req_args->client_fd;
+  struct timeval idle = { req_args->idle_timeout, 0 };
+  int held = 0;
+
+  /* A KEPT-ALIVE CLIENT MAY SIT QUIET FOR idle_timeout SECONDS, THEN IT IS DROPPED.
+     ONLY max_kept WORKERS WAIT LIKE THAT, THE OTHERS CLOSE AFTER EACH RESPONSE */
+  rio_t client_rio;
+  Rio_readinitb(&client_rio, client_fd);
+  setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
 
-  /* RUN HANDLER */
-  request_handler(vargv);
+  /* SERVE PIPELINED REQUESTS IN ORDER */
+  while (serve_request(&client_rio, req_args, &held))
+    ;
+  if (held)
+    __atomic_fetch_sub(req_args->kept, 1, __ATOMIC_RELAXED);
 
-  return NULL;
+  return;
 }
@@ -1,4 +1,8 @@
+#ifndef __HANDLER_H__
+#define __HANDLER_H__
+
 #include <string.h>
+#include <strings.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -6,9 +10,11 @@
 #include <stdlib.h>
 #include "csapp.h"
 #include "cache.h"
+#include "pool.h"
 
 #define MAX_URL_LEN 2048
 #define MAX_STR_LEN 8192
+#define HEAD_ROOM   (MAX_STR_LEN + 128)
 
 #define RESP_LINE   0
 #define RESP_HEAD   1
@@ -26,12 +32,38 @@ typedef struct {
   char version[64];
 } request_line_t;
 
+/* FRAMING OF A RESPONSE, FROM ITS HEAD */
+typedef struct {
+  int status;
+  long body_len;                /* -1 IF NOT GIVEN */
+  int chunked;
+  int reusable;                 /* CONNECTION MAY CARRY ANOTHER REQUEST */
+} response_info_t;
+
+/* WHERE A RESPONSE BODY GOES: THE CLIENT, AND A COPY FOR THE CACHE */
+typedef struct {
+  int fd;
+  int chunked;                  /* RE-CHUNK FOR THE CLIENT */
+  int ok;                       /* 0 ONCE A WRITE TO THE CLIENT FAILED */
+  char *data;
+  size_t len;
+  size_t max;
+} body_sink_t;
+
 typedef struct {
   int client_fd;
   cache_t *global_cache;
+  pool_t *pool;
+  int idle_timeout;             /* SECONDS BETWEEN KEPT-ALIVE REQUESTS */
+  int max_kept;                 /* WORKERS THAT MAY WAIT ON A KEPT-ALIVE CLIENT */
+  int *kept;                    /* HOW MANY DO, SHARED BY ALL WORKERS */
 } req_thread_arg_t;
 
 url_t *parse_url(char* url);
 request_line_t *parse_request_line(char* request);
+int server_request(request_line_t *request_line, char *buf, int keep_alive);
+int forward_header(char *line);
+int send_error(int fd, char *status, int keep_alive);
 void request_handler(void *vargv);
-void *request_thread(void *vargv);
\ No newline at end of file
+
+#endif /* __HANDLER_H__ */
@@ -0,0 +1,159 @@
+#include "pool.h"
+
+static unsigned int hash_origin(char *host, char *port) {
+  /* FNV-1A OVER HOST AND PORT, EACH WITH ITS NUL */
+  unsigned int hash = 2166136261u;
+  char *p;
+
+  for (p = host; ; p++) {
+    hash = (hash ^ (unsigned char)*p) * 16777619u;
+    if (*p == '\0')
+      break;
+  }
+  for (p = port; ; p++) {
+    hash = (hash ^ (unsigned char)*p) * 16777619u;
+    if (*p == '\0')
+      break;
+  }
+  return hash;
+}
+
+static origin_t *find_origin(pool_t *pool, char *host, char *port, int create) {
+  /* CALLER HOLDS THE MUTEX, ONLY THE REAPER FREES ORIGINS */
+  unsigned int hash = hash_origin(host, port);
+  origin_t **bucket = &pool->buckets[hash % POOL_BUCKETS], *origin;
+
+  for (origin = *bucket; origin != NULL; origin = origin->next)
+    if (origin->hash == hash && !strcmp(origin->host, host) && !strcmp(origin->port, port))
+      return origin;
+
+  if (!create || (origin = calloc(1, sizeof(origin_t))) == NULL)
+    return NULL;
+  strncpy(origin->host, host, MAX_HOST_LEN - 1);
+  strncpy(origin->port, port, MAX_PORT_LEN - 1);
+  origin->hash = hash;
+  origin->next = *bucket;
+  *bucket = origin;
+  return origin;
+}
+
+static int is_alive(int fd) {
+  /* AN IDLE CONNECTION HAS NOTHING TO READ, EOF OR STRAY BYTES MEAN IT IS DONE */
+  char c;
+
+  return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void evict(pool_t *pool, origin_t *origin, time_t now) {
+  /* CLOSE WHAT HAS IDLED TOO LONG, CALLER HOLDS THE MUTEX */
+  pool_conn_t **link = &origin->idle, *conn;
+
+  while ((conn = *link) != NULL) {
+    if (now - conn->idle_since >= pool->idle_timeout) {
+      *link = conn->next;
+      close(conn->fd);
+      free(conn);
+      origin->idle_count--;
+    }
+    else
+      link = &conn->next;
+  }
+}
+
+static void *reaper(void *vargp) {
+  pool_t *pool = vargp;
+  origin_t **link, *origin;
+  time_t now;
+  int i;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    sleep(pool->idle_timeout > 1 ? pool->idle_timeout / 2 : 1);
+
+    P(&pool->mutex);
+    now = time(NULL);
+    for (i = 0; i < POOL_BUCKETS; i++) {
+      link = &pool->buckets[i];
+      while ((origin = *link) != NULL) {
+        if (origin->idle != NULL)
+          evict(pool, origin, now);
+
+        /* CLIENTS NAME THE ORIGINS, SO FORGET THOSE NOT SEEN IN A WHILE */
+        if (origin->idle == NULL && now - origin->last_put >= pool->idle_timeout) {
+          *link = origin->next;
+          free(origin);
+        }
+        else
+          link = &origin->next;
+      }
+    }
+    V(&pool->mutex);
+  }
+
+  return NULL;
+}
+
+pool_t *new_pool(int max_idle, int idle_timeout, dns_t *dns) {
+  pool_t *pool = calloc(1, sizeof(pool_t));
+  pthread_t tid;
+
+  if (pool == NULL)
+    unix_error("calloc error");
+  pool->max_idle = max_idle;
+  pool->idle_timeout = idle_timeout;
+  pool->dns = dns;
+  Sem_init(&pool->mutex, 0, 1);
+  if (max_idle > 0)
+    Pthread_create(&tid, NULL, reaper, pool);
+
+  return pool;
+}
+
+int pool_get(pool_t *pool, char *host, char *port, int *reused) {
+  /* AN IDLE CONNECTION THAT PASSES THE CHECK, ELSE A NEW ONE (-1 ON FAILURE) */
+  origin_t *origin;
+  pool_conn_t *conn;
+  int fd;
+
+  P(&pool->mutex);
+  if ((origin = find_origin(pool, host, port, 0)) != NULL)
+    evict(pool, origin, time(NULL));
+  while (origin != NULL && (conn = origin->idle) != NULL) {
+    origin->idle = conn->next;
+    origin->idle_count--;
+    fd = conn->fd;
+    free(conn);
+
+    if (is_alive(fd)) {
+      V(&pool->mutex);
+      *reused = 1;
+      return fd;
+    }
+    close(fd);
+  }
+  V(&pool->mutex);
+
+  *reused = 0;
+  return dns_connect(pool->dns, host, port);
+}
+
+void pool_put(pool_t *pool, char *host, char *port, int fd) {
+  /* KEEP fd FOR THE NEXT REQUEST TO host:port, OR CLOSE IT IF THE ORIGIN HAS ENOUGH */
+  origin_t *origin;
+  pool_conn_t *conn;
+
+  P(&pool->mutex);
+  if (pool->max_idle > 0 && (origin = find_origin(pool, host, port, 1)) != NULL &&
+      origin->idle_count < pool->max_idle && (conn = malloc(sizeof(pool_conn_t))) != NULL) {
+    conn->fd = fd;
+    conn->idle_since = origin->last_put = time(NULL);
+    conn->next = origin->idle;
+    origin->idle = conn;
+    origin->idle_count++;
+    V(&pool->mutex);
+    return;
+  }
+  V(&pool->mutex);
+
+  close(fd);
+}
@@ -0,0 +1,49 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include "cache.h"
+#include "dns.h"
+
+#define POOL_BUCKETS 256
+
+/*
+ * IDLE KEEP-ALIVE CONNECTIONS TO ORIGIN SERVERS
+ *
+ * A WORKER TAKES A CONNECTION FOR host:port WITH pool_get, WHICH HANDS
+ * OUT THE MOST RECENTLY RETURNED ONE THAT STILL LOOKS ALIVE OR OPENS A
+ * NEW ONE, AND GIVES IT BACK WITH pool_put ONCE THE RESPONSE HAS BEEN
+ * READ TO ITS END. AT MOST max_idle CONNECTIONS ARE KEPT PER ORIGIN, AND
+ * A REAPER THREAD CLOSES THOSE IDLE FOR idle_timeout SECONDS, AND FORGETS
+ * AN ORIGIN ONCE IT HAS HAD NO IDLE CONNECTION FOR THAT LONG. NEW
+ * CONNECTIONS LOOK THE ORIGIN UP IN THE RESOLVER CACHE.
+ */
+
+typedef struct pool_conn {
+  int fd;
+  time_t idle_since;
+  struct pool_conn *next;
+} pool_conn_t;
+
+typedef struct origin {
+  char host[MAX_HOST_LEN];
+  char port[MAX_PORT_LEN];
+  unsigned int hash;
+  int idle_count;
+  time_t last_put;
+  pool_conn_t *idle;            /* MOST RECENTLY RETURNED FIRST */
+  struct origin *next;
+} origin_t;
+
+typedef struct {
+  int max_idle;
+  int idle_timeout;
+  dns_t *dns;                   /* RESOLVES NEW CONNECTIONS */
+  origin_t *buckets[POOL_BUCKETS];
+  sem_t mutex;
+} pool_t;
+
+pool_t *new_pool(int max_idle, int idle_timeout, dns_t *dns);
+int pool_get(pool_t *pool, char *host, char *port, int *reused);
+void pool_put(pool_t *pool, char *host, char *port, int fd);
+
+#endif /* __POOL_H__ */
@@ -2,20 +2,164 @@
 #include <stdlib.h>
 #include "csapp.h"
 #include "handler.h"
+#include "sbuf.h"
+#include "event.h"
+#include "uring.h"
 
 /* Recommended max cache sizes */
 #define MAX_CACHE_SIZE  1049000
 #define MAX_OBJ_SIZE    102400
 
+/* Cache shards, each with its own lock for inserts and evictions */
+#define DEFAULT_SHARDS  8
+
+/* Worker pool */
+#define DEFAULT_WORKERS 32
+#define DEFAULT_QUEUE   256     /* accepted connections waiting for a worker */
+#define DEFAULT_STACK   256     /* KB per worker thread */
+#define DEFAULT_IDLE    5       /* seconds a kept-alive client may idle */
+
+/* Idle upstream connections */
+#define DEFAULT_POOL    8       /* kept per origin */
+#define POOL_IDLE       30      /* seconds before one is closed */
+
+/* Resolver cache */
+#define DEFAULT_DNS_TTL 60      /* seconds an answer is reused */
+#define DNS_NEGATIVE    5       /* seconds a failed lookup is reused */
+
 /* Cache */
 static cache_t *global_cache;
+static int idle_timeout = DEFAULT_IDLE;
+
+/* Workers waiting on a kept-alive client, at most half of them */
+static int max_kept;
+static int kept;
+
+/* Upstream connections */
+static pool_t *global_pool;
+static dns_t *global_dns;
+
+/* Accepted connections, handed to the workers */
+static sbuf_t conn_queue;
+
+static const char *busy_response =
+    "HTTP/1.0 503 Service Unavailable\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 12\r\n"
+    "Connection: close\r\n\r\n"
+    "Server busy\n";
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-b] [-s shards] [-t workers] [-q queue] [-k stack_kb] [-i idle_s] [-p per_host] [-d dns_ttl_s] [-e loops] [-u loops] <port>\n", prog);
+    exit(1);
+}
+
+static void *worker(void *vargp)
+{
+    req_thread_arg_t args;
+
+    Pthread_detach(pthread_self());
+    args.global_cache = global_cache;
+    args.idle_timeout = idle_timeout;
+    args.pool = global_pool;
+    args.max_kept = max_kept;
+    args.kept = &kept;
+
+    while (1) {
+        args.client_fd = sbuf_remove(&conn_queue);
+        request_handler(&args);
+        Close(args.client_fd);
+    }
+
+    return NULL;
+}
 
 int main(int argc, char *argv[])
 {
-    char *port = argv[1];
+    char *port;
     pthread_t pid;
+    pthread_attr_t attr;
+    int opt, i, shards = DEFAULT_SHARDS, workers = DEFAULT_WORKERS;
+    int queue = DEFAULT_QUEUE, stack_kb = DEFAULT_STACK, block = 0, loops = -1;
+    int uring = 0, listen_fd, per_host = DEFAULT_POOL, dns_ttl = DEFAULT_DNS_TTL;
 
-    global_cache = new_cache(MAX_CACHE_SIZE, MAX_OBJ_SIZE);
+    while ((opt = getopt(argc, argv, "bs:t:q:k:i:p:d:e:u:")) != -1) {
+        switch (opt) {
+        case 'b':
+            block = 1;
+            break;
+        case 's':
+            if ((shards = atoi(optarg)) < 1)
+                usage(argv[0]);
+            break;
+        case 't':
+            if ((workers = atoi(optarg)) < 1)
+                usage(argv[0]);
+            break;
+        case 'q':
+            if ((queue = atoi(optarg)) < 1)
+                usage(argv[0]);
+            break;
+        case 'i':
+            if ((idle_timeout = atoi(optarg)) < 1)
+                usage(argv[0]);
+            break;
+        case 'p':
+            if ((per_host = atoi(optarg)) < 0)
+                usage(argv[0]);
+            break;
+        case 'd':
+            if ((dns_ttl = atoi(optarg)) < 0)
+                usage(argv[0]);
+            break;
+        case 'e':
+            if ((loops = atoi(optarg)) < 0)
+                usage(argv[0]);
+            break;
+        case 'u':
+            if ((loops = atoi(optarg)) < 0)
+                usage(argv[0]);
+            uring = 1;
+            break;
+        case 'k':
+            if ((stack_kb = atoi(optarg)) < PTHREAD_STACK_MIN / 1024)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+    port = argv[optind];
+
+    /* A client that hangs up early must not kill the proxy */
+    Signal(SIGPIPE, SIG_IGN);
+
+    global_cache = new_cache(MAX_CACHE_SIZE, MAX_OBJ_SIZE, shards);
+    global_dns = new_dns(dns_ttl, dns_ttl < DNS_NEGATIVE ? dns_ttl : DNS_NEGATIVE);
+
+    /* With -e or -u, event loops replace the worker pool */
+    if (loops >= 0) {
+        listen_fd = Open_listenfd(port);
+        if (uring && uring_run(listen_fd, global_cache, global_dns, loops) < 0) {
+            printf("io_uring unavailable (%s), using epoll\n", strerror(errno));
+            fflush(stdout);
+        }
+        event_run(listen_fd, global_cache, global_dns, loops);
+    }
+
+    /* Start the workers up front, with small stacks */
+    global_pool = new_pool(per_host, POOL_IDLE, global_dns);
+    max_kept = workers / 2;
+    sbuf_init(&conn_queue, queue);
+    pthread_attr_init(&attr);
+    if (pthread_attr_setstacksize(&attr, (size_t)stack_kb * 1024) != 0)
+        app_error("pthread_attr_setstacksize error");
+    for (i = 0; i < workers; i++)
+        Pthread_create(&pid, &attr, worker, NULL);
+    pthread_attr_destroy(&attr);
     
     int proxy_fd = Open_listenfd(port);
     struct sockaddr proxy_addr;
@@ -24,11 +168,14 @@ int main(int argc, char *argv[])
         socklen_t addr_length = sizeof(proxy_addr);
         int client_fd = Accept(proxy_fd, &proxy_addr, &addr_length);
 
-        req_thread_arg_t *vargv = malloc(sizeof(req_thread_arg_t));
-        vargv->client_fd = client_fd;
-        vargv->global_cache = global_cache;
-
-        Pthread_create(&pid, NULL, request_thread, (void *)vargv);
+        /* With -b a full queue leaves new connections in the listen backlog */
+        if (block) {
+            sbuf_insert(&conn_queue, client_fd);
+        }
+        else if (sbuf_tryinsert(&conn_queue, client_fd) < 0) {
+            rio_writen(client_fd, (void *)busy_response, strlen(busy_response));
+            Close(client_fd);
+        }
     }
 
     free_cache(global_cache);
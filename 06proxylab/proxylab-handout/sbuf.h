@@ -0,0 +1,23 @@
+#ifndef __SBUF_H__
+#define __SBUF_H__
+
+#include "csapp.h"
+
+/* BOUNDED QUEUE OF CONNECTED FDS, SHARED BY THE ACCEPT LOOP AND THE WORKERS */
+typedef struct {
+  int *buf;          /* BUFFER ARRAY */
+  int n;             /* MAXIMUM NUMBER OF SLOTS */
+  int front;         /* buf[(front+1)%n] IS THE FIRST ITEM */
+  int rear;          /* buf[rear%n] IS THE LAST ITEM */
+  sem_t mutex;       /* PROTECTS ACCESSES TO buf */
+  sem_t slots;       /* COUNTS AVAILABLE SLOTS */
+  sem_t items;       /* COUNTS AVAILABLE ITEMS */
+} sbuf_t;
+
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, int item);
+int sbuf_tryinsert(sbuf_t *sp, int item);
+int sbuf_remove(sbuf_t *sp);
+
+#endif /* __SBUF_H__ */
@@ -0,0 +1,656 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+#define RING_ENTRIES  1024
+#define RELAY_BUFS    256           /* REGISTERED RELAY BUFFERS PER RING */
+
+/* WHAT A COMPLETION IS FOR, IN THE LOW BITS OF user_data (A uconn_t IS 16-ALIGNED) */
+#define TAG_BACKOFF   0             /* ACCEPTS PAUSED FOR LACK OF FDS */
+#define TAG_ACCEPT    1
+#define TAG_RECV      2
+#define TAG_SEND      3
+#define TAG_CONNECT   4
+#define TAG_READ      5
+#define TAG_WRITE     6
+#define TAG_CLOSE     7
+#define TAG_WAKE      8             /* THE RESOLVER INBOX eventfd */
+#define TAG_MASK      15UL
+
+typedef struct {
+  int fd;
+  unsigned sq_entries;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned cq_entries;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned tail;                /* SQ TAIL NOT YET SHOWN TO THE KERNEL */
+  unsigned to_submit;
+
+  int listen_fd;
+  cache_t *cache;
+  dns_t *dns;
+  int multishot;                /* ACCEPT STAYS ARMED */
+  int link;                     /* A SHORT READ CANCELS THE LINKED WRITE */
+  struct __kernel_timespec backoff;
+  time_t reported;              /* LAST accept error MESSAGE */
+  dns_inbox_t inbox;            /* ANSWERS TO THIS RING'S CACHE MISSES */
+  uint64_t wakes;               /* WHERE THE INBOX eventfd IS READ TO */
+
+  /* REGISTERED RELAY BUFFERS AND A STACK OF FREE ONES */
+  char *bufs;
+  int free_bufs[RELAY_BUFS];
+  int free_count;
+} ring_t;
+
+static int ring_setup(ring_t *ring, unsigned entries) {
+  struct io_uring_params p;
+  size_t sq_size, cq_size;
+  char *sq, *cq;
+  unsigned *array, i;
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = entries * 4;
+  if ((ring->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+    return -1;
+
+  /* SOCKETS MUST NOT NEED WORKER THREADS, AND NO COMPLETION MAY BE LOST */
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_FAST_POLL)) {
+    close(ring->fd);
+    errno = ENOSYS;
+    return -1;
+  }
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_size > sq_size)
+    sq_size = cq_size;
+  sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    close(ring->fd);
+    return -1;
+  }
+  cq = sq;
+  ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    munmap(sq, sq_size);
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->sq_entries = p.sq_entries;
+  ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  ring->cq_entries = p.cq_entries;
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  ring->tail = *ring->sq_tail;
+  ring->to_submit = 0;
+
+  /* SQ SLOT i ALWAYS HOLDS SQE i */
+  array = (unsigned *)(sq + p.sq_off.array);
+  for (i = 0; i < p.sq_entries; i++)
+    array[i] = i;
+
+  return 0;
+}
+
+static int ring_supports(ring_t *ring, int *ops, int count) {
+  /* EVERY OPCODE IN ops IS KNOWN TO THE KERNEL */
+  struct io_uring_probe *probe;
+  int i, ok = 1;
+
+  if ((probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op))) == NULL)
+    return 0;
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    ok = 0;
+  for (i = 0; ok && i < count; i++)
+    if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+      ok = 0;
+  free(probe);
+  return ok;
+}
+
+static void ring_register_bufs(ring_t *ring) {
+  /* PIN THE RELAY BUFFERS ONCE, SO READS AND WRITES SKIP THE PAGE LOOKUP */
+  struct iovec iov[RELAY_BUFS];
+  int i;
+
+  ring->free_count = 0;
+  if ((ring->bufs = malloc(RELAY_BUFS * MAX_STR_LEN)) == NULL)
+    return;
+  for (i = 0; i < RELAY_BUFS; i++) {
+    iov[i].iov_base = ring->bufs + i * MAX_STR_LEN;
+    iov[i].iov_len = MAX_STR_LEN;
+  }
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, RELAY_BUFS) < 0) {
+    free(ring->bufs);
+    ring->bufs = NULL;
+    return;
+  }
+  for (i = 0; i < RELAY_BUFS; i++)
+    ring->free_bufs[ring->free_count++] = RELAY_BUFS - 1 - i;
+}
+
+static int ring_submit(ring_t *ring, int wait) {
+  /* HAND OVER QUEUED SQES, AND WITH wait BLOCK FOR A COMPLETION */
+  int ret;
+
+  __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+  ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (ret < 0) {
+    /* EBUSY: THE KERNEL HOLDS OVERFLOWED COMPLETIONS, REAP THEM FIRST */
+    if (errno != EINTR && errno != EBUSY && errno != EAGAIN)
+      unix_error("io_uring_enter error");
+    return -1;
+  }
+  ring->to_submit -= ret;
+  return ret;
+}
+
+static unsigned sq_space(ring_t *ring) {
+  return ring->sq_entries - (ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE));
+}
+
+static void reserve(ring_t *ring, unsigned count) {
+  /* MAKE ROOM FOR count SQES, SO A LINKED PAIR IS NEVER SPLIT */
+  while (sq_space(ring) < count)
+    ring_submit(ring, 0);
+}
+
+static struct io_uring_sqe *prep(ring_t *ring, int opcode, int fd, void *addr, unsigned len, uconn_t *conn, int tag) {
+  struct io_uring_sqe *sqe;
+
+  reserve(ring, 1);
+  sqe = &ring->sqes[ring->tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long)addr;
+  sqe->len = len;
+  sqe->user_data = (uintptr_t)conn | tag;
+  ring->tail++;
+  ring->to_submit++;
+  if (conn != NULL)
+    conn->inflight++;
+  return sqe;
+}
+
+static void prep_relay(ring_t *ring, int read, uconn_t *conn, char *buf, unsigned len) {
+  /* READ FROM THE SERVER OR WRITE TO THE CLIENT, FIXED IF THE BUFFER IS REGISTERED */
+  struct io_uring_sqe *sqe;
+  int fixed = conn->relay_index >= 0;
+
+  if (read)
+    sqe = prep(ring, fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, conn->server_fd, buf, len, conn, TAG_READ);
+  else
+    sqe = prep(ring, fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, conn->client_fd, buf, len, conn, TAG_WRITE);
+  if (fixed)
+    sqe->buf_index = conn->relay_index;
+}
+
+static void arm_accept(ring_t *ring) {
+  struct io_uring_sqe *sqe = prep(ring, IORING_OP_ACCEPT, ring->listen_fd, NULL, 0, NULL, TAG_ACCEPT);
+
+  if (ring->multishot)
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+static void pause_accept(ring_t *ring) {
+  /* RE-ARM THE ACCEPT ONLY WHEN THIS TIMEOUT COMPLETES */
+  ring->backoff.tv_sec = ACCEPT_BACKOFF_MS / 1000;
+  ring->backoff.tv_nsec = (ACCEPT_BACKOFF_MS % 1000) * 1000000L;
+  prep(ring, IORING_OP_TIMEOUT, -1, &ring->backoff, 1, NULL, TAG_BACKOFF);
+}
+
+static void arm_wake(ring_t *ring) {
+  prep(ring, IORING_OP_READ, ring->inbox.fd, &ring->wakes, sizeof(ring->wakes), NULL, TAG_WAKE);
+}
+
+static void prep_close(ring_t *ring, int fd) {
+  prep(ring, IORING_OP_CLOSE, fd, NULL, 0, NULL, TAG_CLOSE);
+}
+
+static void recv_request(ring_t *ring, uconn_t *conn) {
+  prep(ring, IORING_OP_RECV, conn->client_fd, conn->buf + conn->len, MAX_STR_LEN - 1 - conn->len, conn, TAG_RECV);
+}
+
+static void send_cache(ring_t *ring, uconn_t *conn) {
+  struct io_uring_sqe *sqe = prep(ring, IORING_OP_SEND, conn->client_fd, conn->hit->data + conn->off, conn->hit->data_size - conn->off, conn, TAG_SEND);
+
+  sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+static void send_request(ring_t *ring, uconn_t *conn) {
+  struct io_uring_sqe *sqe = prep(ring, IORING_OP_SEND, conn->server_fd, conn->buf + conn->off, conn->len - conn->off, conn, TAG_SEND);
+
+  sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+static void relay_read(ring_t *ring, uconn_t *conn) {
+  /*
+   * READ A CHUNK, AND IF THE KERNEL CANCELS A LINK ON A SHORT READ, QUEUE
+   * THE WRITE OF A FULL CHUNK BEHIND IT. A FULL READ THEN COSTS NO EXTRA
+   * ROUND, A SHORT ONE CANCELS THE WRITE AND relay_read_done SENDS WHAT
+   * CAME.
+   */
+  conn->len = 0;
+  conn->off = 0;
+  if (ring->link) {
+    reserve(ring, 2);
+    prep_relay(ring, 1, conn, conn->relay, MAX_STR_LEN);
+    ring->sqes[(ring->tail - 1) & ring->sq_mask].flags |= IOSQE_IO_LINK;
+    prep_relay(ring, 0, conn, conn->relay, MAX_STR_LEN);
+  }
+  else
+    prep_relay(ring, 1, conn, conn->relay, MAX_STR_LEN);
+}
+
+static void free_conn(ring_t *ring, uconn_t *conn) {
+  /* NOTHING IS IN FLIGHT, SO THE FDS AND BUFFERS ARE OURS AGAIN */
+  if (conn->client_fd >= 0)
+    prep_close(ring, conn->client_fd);
+  if (conn->server_fd >= 0)
+    prep_close(ring, conn->server_fd);
+  if (conn->relay_index >= 0)
+    ring->free_bufs[ring->free_count++] = conn->relay_index;
+  if (conn->hazard != NULL)
+    hazard_release(conn->hazard);
+  if (conn->request_line != NULL) {
+    free(conn->request_line->url);
+    free(conn->request_line);
+  }
+  free(conn->copy.data);
+  free(conn);
+}
+
+static void close_conn(ring_t *ring, uconn_t *conn) {
+  /* A CANCELLED LINKED WRITE MAY STILL BE ON ITS WAY BACK */
+  conn->closing = 1;
+  if (conn->inflight == 0)
+    free_conn(ring, conn);
+}
+
+static int connect_next(ring_t *ring, uconn_t *conn) {
+  /* CONNECT TO THE NEXT ADDRESS THAT GETS A SOCKET, -1 WHEN NONE ARE LEFT */
+  struct io_uring_sqe *sqe;
+  dns_addr_t *addr;
+
+  while (conn->addr_next < conn->addr_count) {
+    addr = &conn->addrs[conn->addr_next++];
+    if ((conn->server_fd = socket(addr->family, addr->socktype, addr->protocol)) < 0)
+      continue;
+    sqe = prep(ring, IORING_OP_CONNECT, conn->server_fd, &addr->addr, 0, conn, TAG_CONNECT);
+    sqe->off = addr->addrlen;
+    return 0;
+  }
+  return -1;
+}
+
+static int bad_gateway(uconn_t *conn) {
+  /* A FEW BYTES TO A CLIENT WE HAVE NOT WRITTEN TO YET, ONE TRY WILL DO */
+  send_error(conn->client_fd, "502 Bad Gateway", 0);
+  return -1;
+}
+
+static int server_found(ring_t *ring, uconn_t *conn, int count) {
+  /* count ADDRESSES ARE IN conn->addrs, OR count IS A getaddrinfo ERROR */
+  url_t *url = conn->request_line->url;
+
+  if (count < 0) {
+    printf("getaddrinfo failed (%s:%s): %s\n", url->hostname, url->port, gai_strerror(count));
+    return bad_gateway(conn);
+  }
+  conn->addr_count = count;
+  conn->addr_next = 0;
+
+  if (connect_next(ring, conn) < 0)
+    return bad_gateway(conn);
+  return 0;
+}
+
+static int open_server(ring_t *ring, uconn_t *conn) {
+  /* START CONNECTING, OR WAIT WITH NOTHING IN FLIGHT WHILE A RESOLVER THREAD LOOKS THE NAME UP */
+  url_t *url = conn->request_line->url;
+  dns_query_t *query;
+  int count;
+
+  if (dns_cached(ring->dns, url->hostname, url->port, conn->addrs, DNS_MAX_ADDRS, &count))
+    return server_found(ring, conn, count);
+  if ((query = new_query(url, conn)) == NULL)
+    return bad_gateway(conn);
+  dns_submit(ring->dns, &ring->inbox, query);
+  return 0;
+}
+
+static void resolved(ring_t *ring, int res) {
+  /* THE INBOX eventfd WAS READ, PICK UP THE LOOKUPS THE RESOLVER THREADS FINISHED */
+  dns_query_t *query, *next;
+  uconn_t *conn;
+
+  if (res < 0 && res != -EINTR && res != -EAGAIN)
+    unix_error("eventfd read error");
+  for (query = dns_take(&ring->inbox); query != NULL; query = next) {
+    next = query->next;
+    conn = query->owner;
+    memcpy(conn->addrs, query->addrs, sizeof(conn->addrs));
+    if (server_found(ring, conn, query->result) < 0)
+      close_conn(ring, conn);
+    free(query);
+  }
+  arm_wake(ring);
+}
+
+static int start_request(ring_t *ring, uconn_t *conn) {
+  url_t *url;
+
+  conn->request_line = parse_request_line(conn->buf);
+  url = conn->request_line->url;
+  if (strcmp(conn->request_line->method, "GET")) {
+    printf("This proxy only accepts GET method!\n");
+    return -1;
+  }
+
+  /* CHECK CACHE */
+  if ((conn->hit = hold_hit(ring->cache, url, &conn->hazard)) != NULL) {
+    conn->state = UCONN_SEND_CACHE;
+    conn->off = 0;
+    send_cache(ring, conn);
+    return 0;
+  }
+
+  if (rewrite_request(conn->request_line, conn->buf, &conn->len) < 0)
+    return -1;
+  conn->off = 0;
+
+  conn->state = UCONN_CONNECT;
+  return open_server(ring, conn);
+}
+
+static int relay_read_done(ring_t *ring, uconn_t *conn, int res) {
+  if (res < 0)
+    return -1;
+  if (res == 0) {
+    copy_push(ring->cache, conn->request_line->url, &conn->copy);
+    return -1;
+  }
+
+  copy_append(ring->cache, &conn->copy, conn->relay, res);
+  conn->len = res;
+  conn->off = 0;
+
+  /* A FULL CHUNK IS ALREADY BEING WRITTEN BY THE LINKED WRITE */
+  if (!(ring->link && res == MAX_STR_LEN))
+    prep_relay(ring, 0, conn, conn->relay, res);
+  return 0;
+}
+
+static int relay_write_done(ring_t *ring, uconn_t *conn, int res) {
+  /* THE LINKED WRITE OF A SHORT READ, ALREADY REPLACED */
+  if (res == -ECANCELED)
+    return 0;
+  if (res <= 0)
+    return -1;
+
+  conn->off += res;
+  if (conn->off < conn->len) {
+    prep_relay(ring, 0, conn, conn->relay + conn->off, conn->len - conn->off);
+    return 0;
+  }
+  relay_read(ring, conn);
+  return 0;
+}
+
+static int step(ring_t *ring, uconn_t *conn, int tag, int res) {
+  /* ADVANCE conn ON A COMPLETION, -1 TO CLOSE IT */
+  switch (conn->state) {
+  case UCONN_RECV_REQUEST:
+    if (res <= 0)
+      return -1;
+    conn->len += res;
+    conn->buf[conn->len] = '\0';
+    if (strstr(conn->buf, "\r\n\r\n") != NULL)
+      return start_request(ring, conn);
+    if (conn->len >= MAX_STR_LEN - 1)
+      return -1;
+    recv_request(ring, conn);
+    return 0;
+
+  case UCONN_SEND_CACHE:
+    if (res <= 0)
+      return -1;
+    conn->off += res;
+    if (conn->off == conn->hit->data_size)
+      return -1;
+    send_cache(ring, conn);
+    return 0;
+
+  case UCONN_CONNECT:
+    if (res < 0) {
+      /* THAT ADDRESS IS UNREACHABLE, TRY THE NEXT ONE */
+      prep_close(ring, conn->server_fd);
+      conn->server_fd = -1;
+      if (connect_next(ring, conn) == 0)
+        return 0;
+      printf("connect failed (%s:%s): %s\n", conn->request_line->url->hostname, conn->request_line->url->port, strerror(-res));
+      return bad_gateway(conn);
+    }
+    conn->state = UCONN_SEND_REQUEST;
+    send_request(ring, conn);
+    return 0;
+
+  case UCONN_SEND_REQUEST:
+    if (res <= 0)
+      return -1;
+    conn->off += res;
+    if (conn->off < conn->len) {
+      send_request(ring, conn);
+      return 0;
+    }
+
+    /* TAKE A REGISTERED BUFFER IF ONE IS LEFT */
+    if (ring->free_count > 0) {
+      conn->relay_index = ring->free_bufs[--ring->free_count];
+      conn->relay = ring->bufs + conn->relay_index * MAX_STR_LEN;
+    }
+    else
+      conn->relay = conn->buf;
+    conn->state = UCONN_RELAY;
+    relay_read(ring, conn);
+    return 0;
+
+  case UCONN_RELAY:
+    return tag == TAG_READ ? relay_read_done(ring, conn, res) : relay_write_done(ring, conn, res);
+  }
+  return -1;
+}
+
+static void accept_done(ring_t *ring, int res, unsigned flags) {
+  uconn_t *conn;
+
+  if (res < 0) {
+    if (res == -EINVAL && ring->multishot) {
+      /* OLDER KERNEL, ACCEPT ONE AT A TIME */
+      ring->multishot = 0;
+      arm_accept(ring);
+      return;
+    }
+    if (res != -EAGAIN && res != -ECONNABORTED && res != -EINTR && time(NULL) != ring->reported) {
+      ring->reported = time(NULL);
+      printf("accept error: %s\n", strerror(-res));
+    }
+    if ((res == -EMFILE || res == -ENFILE) && !(flags & IORING_CQE_F_MORE)) {
+      /* THE BACKLOG STAYS READY, SO WAIT FOR CONNECTIONS TO CLOSE */
+      pause_accept(ring);
+      return;
+    }
+  }
+  else if ((conn = calloc(1, sizeof(uconn_t))) == NULL)
+    prep_close(ring, res);
+  else {
+    conn->state = UCONN_RECV_REQUEST;
+    conn->client_fd = res;
+    conn->server_fd = -1;
+    conn->relay_index = -1;
+    recv_request(ring, conn);
+  }
+
+  if (!(flags & IORING_CQE_F_MORE))
+    arm_accept(ring);
+}
+
+static void complete(ring_t *ring, struct io_uring_cqe *cqe) {
+  uconn_t *conn = (uconn_t *)(uintptr_t)(cqe->user_data & ~TAG_MASK);
+  int tag = cqe->user_data & TAG_MASK;
+
+  if (tag == TAG_ACCEPT) {
+    accept_done(ring, cqe->res, cqe->flags);
+    return;
+  }
+  if (tag == TAG_BACKOFF) {
+    arm_accept(ring);
+    return;
+  }
+  if (tag == TAG_WAKE) {
+    resolved(ring, cqe->res);
+    return;
+  }
+  if (tag == TAG_CLOSE)
+    return;
+
+  conn->inflight--;
+  if (conn->closing) {
+    if (conn->inflight == 0)
+      free_conn(ring, conn);
+    return;
+  }
+  if (step(ring, conn, tag, cqe->res) < 0)
+    close_conn(ring, conn);
+}
+
+static void reap(ring_t *ring) {
+  /* AT MOST HALF AN SQ OF COMPLETIONS, EACH QUEUES NO MORE THAN TWO SQES */
+  unsigned head = *ring->cq_head, tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE), count = 0;
+  struct io_uring_cqe cqe;
+
+  while (head != tail && count++ < ring->sq_entries / 2) {
+    cqe = ring->cqes[head & ring->cq_mask];
+    __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+    complete(ring, &cqe);
+  }
+}
+
+static int probe_link(ring_t *ring) {
+  /* DOES A SHORT SOCKET READ CANCEL THE WRITE LINKED BEHIND IT? */
+  int in[2], out[2], seen = 0, read_res = 0, write_res = 0;
+  char *buf = ring->bufs != NULL ? ring->bufs : malloc(MAX_STR_LEN);
+  uconn_t conn;
+  struct io_uring_cqe *cqe;
+  unsigned head;
+
+  if (buf == NULL)
+    return 0;
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, out) < 0)
+    return 0;
+  memset(&conn, 0, sizeof(conn));
+  conn.server_fd = in[0];
+  conn.client_fd = out[0];
+  conn.relay_index = ring->bufs != NULL ? 0 : -1;
+  if (write(in[1], "x", 1) != 1)
+    return 0;
+
+  reserve(ring, 2);
+  prep_relay(ring, 1, &conn, buf, MAX_STR_LEN);
+  ring->sqes[(ring->tail - 1) & ring->sq_mask].flags |= IOSQE_IO_LINK;
+  prep_relay(ring, 0, &conn, buf, MAX_STR_LEN);
+  while (seen < 2) {
+    ring_submit(ring, 1);
+    head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      cqe = &ring->cqes[head & ring->cq_mask];
+      if ((cqe->user_data & TAG_MASK) == TAG_READ)
+        read_res = cqe->res;
+      else
+        write_res = cqe->res;
+      __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+      seen++;
+    }
+  }
+
+  close(in[0]);
+  close(in[1]);
+  close(out[0]);
+  close(out[1]);
+  if (ring->bufs == NULL)
+    free(buf);
+  return read_res == 1 && write_res == -ECANCELED;
+}
+
+static void *ring_thread(void *vargp) {
+  ring_t *ring = vargp;
+
+  arm_accept(ring);
+  arm_wake(ring);
+  while (1) {
+    ring_submit(ring, 1);
+    reap(ring);
+  }
+
+  return NULL;
+}
+
+int uring_run(int listen_fd, cache_t *cache, dns_t *dns, int loops) {
+  /* RUN loops RINGS (0 FOR ONE PER CPU), RETURN -1 ONLY IF IO_URING IS UNUSABLE */
+  int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_CONNECT, IORING_OP_READ,
+                IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_CLOSE, IORING_OP_TIMEOUT };
+  ring_t **rings;
+  pthread_t tid;
+  struct rlimit limit;
+  int i;
+
+  if (loops <= 0 && (loops = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+    loops = 1;
+  if ((rings = calloc(loops, sizeof(ring_t *))) == NULL)
+    return -1;
+
+  /* SET UP EVERY RING BEFORE STARTING ANY, SO FAILING LEAVES NOTHING RUNNING */
+  for (i = 0; i < loops; i++) {
+    if ((rings[i] = calloc(1, sizeof(ring_t))) == NULL || ring_setup(rings[i], RING_ENTRIES) < 0)
+      return -1;
+    if (!ring_supports(rings[i], ops, sizeof(ops) / sizeof(ops[0])))
+      return -1;
+    rings[i]->listen_fd = listen_fd;
+    rings[i]->cache = cache;
+    rings[i]->dns = dns;
+    rings[i]->multishot = 1;
+    dns_inbox_init(dns, &rings[i]->inbox);
+    ring_register_bufs(rings[i]);
+    rings[i]->link = probe_link(rings[i]);
+  }
+  printf("io_uring: %d rings, %s relay buffers, %s read-write links\n", loops,
+         rings[0]->bufs != NULL ? "registered" : "plain", rings[0]->link ? "with" : "without");
+  fflush(stdout);
+
+  /* ONE FD PER CLIENT AND ONE PER SERVER, TAKE ALL WE MAY */
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  for (i = 0; i < loops - 1; i++)
+    Pthread_create(&tid, NULL, ring_thread, rings[i]);
+  ring_thread(rings[loops - 1]);
+  return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include "event.h"
+
+/*
+ * IO_URING MODE
+ *
+ * THE SAME CONNECTION STATE MACHINE AS EPOLL MODE, DRIVEN BY COMPLETIONS
+ * INSTEAD OF READINESS. EACH LOOP OWNS ONE RING: ONE MULTISHOT ACCEPT
+ * FEEDS IT CONNECTIONS, AND EVERY RECV, SEND, CONNECT AND CLOSE IS A
+ * SUBMISSION QUEUE ENTRY. A LOOP ROUND IS ONE io_uring_enter THAT BOTH
+ * SUBMITS EVERYTHING QUEUED SINCE THE LAST ROUND AND WAITS FOR MORE
+ * COMPLETIONS. THE RELAY READS INTO BUFFERS REGISTERED WITH THE RING
+ * AND LINKS THE WRITE TO THE CLIENT BEHIND THE READ. A READ OF THE
+ * RESOLVER INBOX eventfd STAYS QUEUED, SO ANSWERS TO CACHE MISSES
+ * ARRIVE AS COMPLETIONS TOO.
+ */
+
+typedef enum {
+  UCONN_RECV_REQUEST,           /* READING REQUEST LINE AND HEADERS */
+  UCONN_CONNECT,                /* WAITING FOR THE SERVER TO ACCEPT */
+  UCONN_SEND_REQUEST,           /* WRITING THE REQUEST TO THE SERVER */
+  UCONN_RELAY,                  /* SERVER RESPONSE TO CLIENT */
+  UCONN_SEND_CACHE              /* CACHED OBJECT TO CLIENT */
+} uconn_state_t;
+
+typedef struct {
+  uconn_state_t state;
+  int client_fd;
+  int server_fd;
+  int inflight;                 /* SUBMITTED, NOT YET COMPLETED */
+  int closing;                  /* FREE ONCE inflight DROPS TO 0 */
+  request_line_t *request_line;
+
+  /* SERVER ADDRESSES, TRIED IN TURN, THE KERNEL READS ONE WHILE ITS CONNECT RUNS */
+  dns_addr_t addrs[DNS_MAX_ADDRS];
+  int addr_count;
+  int addr_next;
+
+  /* REQUEST, THEN UPSTREAM REQUEST */
+  char buf[MAX_STR_LEN];
+  size_t len;
+  size_t off;
+
+  /* RELAY BUFFER, A REGISTERED ONE WHEN relay_index >= 0, ELSE buf */
+  char *relay;
+  int relay_index;
+
+  /* CACHE HIT BEING WRITTEN, KEPT ALIVE BY hazard */
+  cache_obj_t *hit;
+  hazard_t *hazard;
+
+  response_copy_t copy;
+} __attribute__((aligned(16))) uconn_t;  /* LEAVES FOUR TAG BITS IN user_data */
+
+int uring_run(int listen_fd, cache_t *cache, dns_t *dns, int loops);
+
+#endif /* __URING_H__ */